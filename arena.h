@@ -0,0 +1,93 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#ifndef VOLUME_EXPLORER_ARENA_H
+#define VOLUME_EXPLORER_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bump allocator for the scratch buffers of a command (expanded paths,
+// command lines, messages), which used to pile up on the stack. Buffers are freed
+// together when the VexScratch scope that took them ends.
+class VexArena {
+    uint8_t *mem;
+    size_t size;
+    size_t used = 0;
+    size_t peak = 0;
+    uint32_t failures = 0;
+
+  public:
+    VexArena(void *_mem, size_t _size) : mem((uint8_t *)_mem), size(_size) {}
+
+    // NULL once full
+    void *alloc(size_t n) {
+        n = (n + 7) & ~(size_t)7;
+        if (n > size - used) {
+            failures++;
+            return NULL;
+        }
+        void *p = &mem[used];
+        used += n;
+        if (used > peak)
+            peak = used;
+        return p;
+    }
+    size_t mark() {
+        return used;
+    }
+    void release(size_t m) {
+        used = m;
+    }
+    size_t capacity() {
+        return size;
+    }
+    size_t in_use() {
+        return used;
+    }
+    size_t high_water() {
+        return peak;
+    }
+    uint32_t failed() {
+        return failures;
+    }
+};
+
+template <size_t N> class VexStaticArena : public VexArena {
+    uint64_t buf[(N + 7) / 8];
+
+  public:
+    VexStaticArena() : VexArena(buf, sizeof(buf)) {}
+};
+
+class VexScratch {
+    VexArena &arena;
+    size_t m;
+
+  public:
+    VexScratch(VexArena &_arena) : arena(_arena), m(_arena.mark()) {}
+    ~VexScratch() {
+        arena.release(m);
+    }
+};
+
+#endif
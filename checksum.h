@@ -0,0 +1,51 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#ifndef VOLUME_EXPLORER_CHECKSUM_H
+#define VOLUME_EXPLORER_CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, the zip / png one), start with 0 and feed the
+// previous result back to checksum data given in several chunks
+uint32_t vex_crc32(uint32_t crc, const void *buf, size_t len);
+
+// Adler-32 (the zlib one), start with 1
+uint32_t vex_adler32(uint32_t adler, const void *buf, size_t len);
+
+// SHA-256, begin() then update() with the data in as many chunks as
+// needed, end() gives the 32 bytes digest
+class VexSha256 {
+    uint32_t h[8];
+    uint64_t len;
+    uint8_t block[64];
+
+    void transform(uint8_t const *p);
+
+  public:
+    void begin();
+    void update(const void *buf, size_t n);
+    void end(uint8_t *digest);
+};
+
+#endif
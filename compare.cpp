@@ -0,0 +1,271 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#include "volume_explorer.h"
+
+#ifdef VOLUME_EXPLORER_COMPARE_ENABLE
+
+// Opens filename1 as src_f and filename2 as cmp_f, read with the same 2KB
+// chunks as cp
+bool VolumeExplorerSession::compare_open(char const *filename1, char const *filename2) {
+    expand_path(filename2, task.cmp_file);
+    if (!open_src(filename1))
+        return false;
+    if (!check_free(task.cmp_file, false)) {
+        task.src_f.close();
+        return false;
+    }
+    if (!open_file(task.cmp_f, task.cmp_file, O_RDONLY)) {
+        error("%s not found", filename2);
+        task.src_f.close();
+        return false;
+    }
+    if (task.src_f.isDir() || task.cmp_f.isDir()) {
+        error("can't compare directories");
+        task.src_f.close();
+        task.cmp_f.close();
+        return false;
+    }
+    return true;
+}
+
+// cmp [-c] file1 file2 : offset of the first difference, or with -c the
+// number of bytes that differ. Nothing is printed for identical files.
+void VolumeExplorerSession::cmd_cmp(int argc, char **argv) {
+    char const *arg1 = argv[0], *arg2 = argv[1], *arg3 = argv[2];
+    bool count_all = strcmp(arg1, "-c") == 0;
+
+    if (count_all != (arg3 != NULL)) {
+        error("cmp [-c] file1 file2");
+        status = VEX_STATUS_BAD_COMMAND;
+        return;
+    }
+    if (!compare_open(count_all ? arg2 : arg1, count_all ? arg3 : arg2))
+        return;
+    task_start(CMD_CMP);
+    task.count_all = count_all;
+    task.diffs = 0;
+}
+
+bool VolumeExplorerSession::step_cmp() {
+    uint8_t *a = (uint8_t *)task.fbuf[0];
+    uint8_t *b = (uint8_t *)task.fbuf[1];
+    int n1 = task.src_f.read(a, VOLUME_EXPLORER_COPY_BUFSIZE);
+    int n2 = task.cmp_f.read(b, VOLUME_EXPLORER_COPY_BUFSIZE);
+    int n = n1 < n2 ? n1 : n2;
+    uint32_t w1, w2, x;
+    char sbuf[21];
+
+    if (n1 < 0 || n2 < 0) {
+        error("%s read error", n1 < 0 ? task.src_file : task.cmp_file);
+        return false;
+    }
+    VEX_STAT(bytes_read, n1 + n2);
+    for (int i = 0; i < n;) {
+        // a word at a time, bytes only where words differ
+        if (i + 4 <= n) {
+            memcpy(&w1, &a[i], 4);
+            memcpy(&w2, &b[i], 4);
+            if (w1 == w2) {
+                i += 4;
+                continue;
+            }
+            if (task.count_all) {
+                x = w1 ^ w2;
+                task.diffs += ((x & 0xFF) != 0) + ((x & 0xFF00) != 0) + ((x & 0xFF0000) != 0) + ((x & 0xFF000000) != 0);
+                i += 4;
+                continue;
+            }
+        }
+        if (a[i] != b[i]) {
+            if (!task.count_all) {
+                term->printf("%s %s differ: byte %s\n", task.src_file, task.cmp_file, u64toa(task.bytes + i + 1, sbuf));
+                return false;
+            }
+            task.diffs++;
+        }
+        i++;
+    }
+    task.bytes += n;
+    if (n1 == n2 && n1 > 0)
+        return true;
+    if (task.count_all && task.diffs > 0)
+        term->printf("%s bytes differ\n", u64toa(task.diffs, sbuf));
+    if (n1 != n2)
+        term->printf("EOF on %s after byte %s\n", n1 < n2 ? task.src_file : task.cmp_file, u64toa(task.bytes, sbuf));
+    return false;
+}
+
+// diff file1 file2 : the changes in the "normal" diff format. Lines are
+// compared by hash, a change ends at the nearest pair of equal lines found
+// in the next VOLUME_EXPLORER_DIFF_LINES lines of each file, so the memory
+// used doesn't depend on the files.
+void VolumeExplorerSession::cmd_diff(int argc, char **argv) {
+    if (!compare_open(argv[0], argv[1]))
+        return;
+    if (task.src_f.fileSize() > 0xFFFFFFFFULL || task.cmp_f.fileSize() > 0xFFFFFFFFULL) {
+        error("files too large for diff");
+        task.src_f.close();
+        task.cmp_f.close();
+        return;
+    }
+    task_start(CMD_DIFF);
+    for (int k = 0; k < 2; k++) {
+        task.lines[k] = 0;
+        diff_seek(k, 0);
+    }
+}
+
+void VolumeExplorerSession::diff_seek(int k, uint32_t offset) {
+    (k ? task.cmp_f : task.src_f).seekSet(offset);
+    task.line_off[k] = offset;
+    task.line_pos[k] = task.line_len[k] = 0;
+}
+
+// FNV-1a hash of the next line of file k, its '\n' included so that a last
+// line without one differs. False at the end of the file
+bool VolumeExplorerSession::diff_line(int k, uint32_t *hash) {
+    FsFile &f = k ? task.cmp_f : task.src_f;
+    uint8_t *buf = (uint8_t *)task.fbuf[k];
+    uint32_t h = 2166136261UL;
+    bool any = false;
+    uint8_t c;
+
+    while (true) {
+        if (task.line_pos[k] == task.line_len[k]) {
+            int n = f.read(buf, VOLUME_EXPLORER_COPY_BUFSIZE);
+            if (n <= 0)
+                break; // last line without a newline
+            VEX_STAT(bytes_read, n);
+            task.line_pos[k] = 0;
+            task.line_len[k] = n;
+        }
+        c = buf[task.line_pos[k]++];
+        task.line_off[k]++;
+        any = true;
+        h = (h ^ c) * 16777619UL;
+        if (c == '\n')
+            break;
+    }
+    *hash = h;
+    return any;
+}
+
+// Prints line of the window of file k, the line reader is reset afterwards
+void VolumeExplorerSession::diff_print(int k, int line, char const *prefix) {
+    FsFile &f = k ? task.cmp_f : task.src_f;
+    char *buf = task.fbuf[k];
+    uint32_t left = task.diff_off[k][line + 1] - task.diff_off[k][line];
+    bool newline = false;
+    int n;
+
+    f.seekSet(task.diff_off[k][line]);
+    term->print(prefix);
+    while (left > 0 && (n = f.read(buf, left < VOLUME_EXPLORER_COPY_BUFSIZE ? left : VOLUME_EXPLORER_COPY_BUFSIZE)) > 0) {
+        VEX_STAT(bytes_read, n);
+        left -= n;
+        if (left == 0 && buf[n - 1] == '\n') {
+            newline = true;
+            n--;
+        }
+        term->write((uint8_t *)buf, n);
+    }
+    term->print(newline ? "\n" : "\n\\ No newline at end of file\n");
+}
+
+// Lines n1 of the first window replaced by lines n2 of the second one
+void VolumeExplorerSession::diff_hunk(int n1, int n2) {
+    unsigned long l1 = task.lines[0], l2 = task.lines[1];
+
+    if (n1 > 1)
+        term->printf("%lu,%lu", l1 + 1, l1 + n1);
+    else
+        term->printf("%lu", l1 + n1);
+    term->print(n1 == 0 ? 'a' : n2 == 0 ? 'd' : 'c');
+    if (n2 > 1)
+        term->printf("%lu,%lu\n", l2 + 1, l2 + n2);
+    else
+        term->printf("%lu\n", l2 + n2);
+    for (int i = 0; i < n1; i++)
+        diff_print(0, i, "< ");
+    if (n1 > 0 && n2 > 0)
+        term->print("---\n");
+    for (int i = 0; i < n2; i++)
+        diff_print(1, i, "> ");
+    task.count++;
+}
+
+// Skips a common line, or loads the windows at a difference and prints
+// the change up to the first lines the files have in common again
+bool VolumeExplorerSession::step_diff() {
+    uint32_t h[2], off[2] = {task.line_off[0], task.line_off[1]};
+    bool end[2];
+    int n[2], i, j, s;
+
+    for (int k = 0; k < 2; k++)
+        end[k] = !diff_line(k, &h[k]);
+    if (end[0] && end[1])
+        return false;
+    if (!end[0] && !end[1] && h[0] == h[1]) {
+        task.lines[0]++;
+        task.lines[1]++;
+        return true;
+    }
+    for (int k = 0; k < 2; k++) {
+        task.diff_off[k][0] = off[k];
+        task.diff_hash[k][0] = h[k];
+        n[k] = end[k] ? 0 : 1;
+        while (n[k] < VOLUME_EXPLORER_DIFF_LINES) {
+            task.diff_off[k][n[k]] = task.line_off[k];
+            if (!diff_line(k, &task.diff_hash[k][n[k]]))
+                break;
+            n[k]++;
+        }
+        task.diff_off[k][n[k]] = task.line_off[k];
+        end[k] = n[k] < VOLUME_EXPLORER_DIFF_LINES;
+    }
+    // nearest equal lines, i + j as small as possible
+    for (s = 1; s <= n[0] + n[1] - 2; s++) {
+        for (i = s < n[1] ? 0 : s - n[1] + 1; i <= s && i < n[0]; i++)
+            if (task.diff_hash[0][i] == task.diff_hash[1][s - i])
+                break;
+        if (i <= s && i < n[0])
+            break;
+    }
+    if (s <= n[0] + n[1] - 2) {
+        j = s - i;
+    } else {
+        // no common line in sight, the windows are a change of their own
+        i = n[0];
+        j = n[1];
+    }
+    diff_hunk(i, j);
+    task.lines[0] += i;
+    task.lines[1] += j;
+    if (i == n[0] && j == n[1] && end[0] && end[1])
+        return false;
+    diff_seek(0, task.diff_off[0][i]);
+    diff_seek(1, task.diff_off[1][j]);
+    return true;
+}
+
+#endif
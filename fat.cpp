@@ -0,0 +1,259 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#include "fat.h"
+#include "rpc.h"
+
+#define VEX_MBR_PARTITIONS 446
+#define VEX_EXFAT_BITMAP_ENTRY 0x81
+#define VEX_EXFAT_ROOT_MAX_CLUSTERS 64
+
+uint8_t const *VexFat::sector(uint32_t s) {
+    if (s == cache_sector)
+        return cache;
+    if (!flush())
+        return NULL;
+    if (!card->readSectors(s, cache, 1)) {
+        cache_sector = 0xFFFFFFFF;
+        read_errors++;
+        return NULL;
+    }
+    cache_sector = s;
+    return cache;
+}
+
+static bool is_boot_sector(uint8_t const *bs) {
+    if (memcmp(&bs[3], "EXFAT   ", 8) == 0)
+        return true;
+    return (bs[0] == 0xEB || bs[0] == 0xE9) && vex_get16(&bs[11]) == VEX_SECTOR_SIZE && bs[13] != 0;
+}
+
+bool VexFat::begin(SdCard *_card) {
+    uint8_t const *bs;
+
+    card = _card;
+    type = VEX_FAT_NONE;
+    cache_sector = 0xFFFFFFFF;
+    dirty = 0;
+    part_start = 0;
+    if ((bs = sector(0)) == NULL || bs[510] != 0x55 || bs[511] != 0xAA)
+        return false;
+    if (!is_boot_sector(bs)) {
+        // MBR, the volume is the first partition, as for SdFat
+        for (int i = 0; i < 4 && part_start == 0; i++) {
+            if (bs[VEX_MBR_PARTITIONS + 16 * i + 4] != 0)
+                part_start = vex_get32(&bs[VEX_MBR_PARTITIONS + 16 * i + 8]);
+        }
+        if (part_start == 0 || (bs = sector(part_start)) == NULL || !is_boot_sector(bs))
+            return false;
+    }
+    return memcmp(&bs[3], "EXFAT   ", 8) == 0 ? begin_exfat(bs) : begin_fat(bs);
+}
+
+bool VexFat::begin_fat(uint8_t const *bs) {
+    uint32_t spc = bs[13];
+    uint32_t reserved = vex_get16(&bs[14]);
+    uint32_t fats = bs[16];
+    uint32_t root_size = (vex_get16(&bs[17]) * 32 + VEX_SECTOR_SIZE - 1) / VEX_SECTOR_SIZE;
+    uint32_t total = vex_get16(&bs[19]) ? vex_get16(&bs[19]) : vex_get32(&bs[32]);
+    uint32_t fat_size = vex_get16(&bs[22]) ? vex_get16(&bs[22]) : vex_get32(&bs[36]);
+
+    if ((spc & (spc - 1)) != 0 || reserved == 0 || fats == 0 || fat_size == 0)
+        return false;
+    fat_start = part_start + reserved;
+    fat_sectors = fat_size;
+    fat_count = fats;
+    root_start = fat_start + fats * fat_size;
+    data_start = root_start + root_size;
+    if (total <= data_start - part_start)
+        return false;
+    cluster_count = (total - (data_start - part_start)) / spc;
+    if (cluster_count < 4085)
+        return false; // FAT12, not on SD cards
+    sectors_per_cluster = spc;
+    data_end = data_start + cluster_count * spc;
+    type = cluster_count < 65525 ? VEX_FAT_16 : VEX_FAT_32;
+    root_cluster = type == VEX_FAT_32 ? vex_get32(&bs[44]) : 0;
+    root_sectors = root_size;
+    bitmap_start = 0;
+    return true;
+}
+
+bool VexFat::begin_exfat(uint8_t const *bs) {
+    uint8_t const *p;
+    uint32_t c;
+
+    if (bs[108] != 9) // bytes per sector shift
+        return false;
+    fat_start = part_start + vex_get32(&bs[80]);
+    fat_sectors = vex_get32(&bs[84]);
+    fat_count = 1;
+    root_start = 0;
+    root_sectors = 0;
+    data_start = part_start + vex_get32(&bs[88]);
+    cluster_count = vex_get32(&bs[92]);
+    root_cluster = vex_get32(&bs[96]);
+    sectors_per_cluster = 1UL << bs[109];
+    data_end = data_start + cluster_count * sectors_per_cluster;
+    type = VEX_FAT_EX;
+    // the allocation bitmap is an entry of the root directory, formatters
+    // write it first and contiguous
+    c = root_cluster;
+    for (int i = 0; i < VEX_EXFAT_ROOT_MAX_CLUSTERS && c >= 2 && c < cluster_count + 2; i++, c = entry(c)) {
+        for (uint32_t s = 0; s < sectors_per_cluster; s++) {
+            if ((p = sector(data_start + (c - 2) * sectors_per_cluster + s)) == NULL)
+                break;
+            for (int e = 0; e < VEX_SECTOR_SIZE; e += 32) {
+                if (p[e] == VEX_EXFAT_BITMAP_ENTRY) {
+                    bitmap_start = data_start + (vex_get32(&p[e + 20]) - 2) * sectors_per_cluster;
+                    return true;
+                }
+                if (p[e] == 0) // end of directory
+                    break;
+            }
+        }
+    }
+    type = VEX_FAT_NONE;
+    return false;
+}
+
+uint32_t VexFat::entry(uint32_t cluster) {
+    uint32_t offset = cluster * (type == VEX_FAT_16 ? 2 : 4);
+    uint8_t const *p = sector(fat_start + offset / VEX_SECTOR_SIZE);
+
+    if (!p)
+        return 0xFFFFFFFF;
+    p += offset % VEX_SECTOR_SIZE;
+    if (type == VEX_FAT_16)
+        return vex_get16(p);
+    return type == VEX_FAT_32 ? vex_get32(p) & 0x0FFFFFFF : vex_get32(p);
+}
+
+bool VexFat::read(uint32_t s, uint8_t *dst) {
+    uint8_t const *p = sector(s);
+
+    if (!p)
+        return false;
+    memcpy(dst, p, VEX_SECTOR_SIZE);
+    return true;
+}
+
+bool VexFat::release(uint32_t cluster) {
+    uint32_t bit = cluster - 2;
+    uint32_t offset = cluster * (type == VEX_FAT_16 ? 2 : 4);
+    uint8_t *p;
+
+    if (type == VEX_FAT_NONE || !is_cluster(cluster))
+        return false;
+    if (type == VEX_FAT_EX) {
+        if ((p = (uint8_t *)sector(bitmap_start + bit / (VEX_SECTOR_SIZE * 8))) == NULL)
+            return false;
+        p[(bit / 8) % VEX_SECTOR_SIZE] &= ~(1 << (bit % 8));
+        dirty = 1;
+        return true;
+    }
+    if ((p = (uint8_t *)sector(fat_start + offset / VEX_SECTOR_SIZE)) == NULL)
+        return false;
+    p += offset % VEX_SECTOR_SIZE;
+    if (type == VEX_FAT_16)
+        vex_put16(p, 0);
+    else
+        vex_put32(p, vex_get32(p) & 0xF0000000);
+    dirty = fat_count;
+    return true;
+}
+
+// A FAT sector goes to every copy, they are fat_sectors apart
+bool VexFat::flush() {
+    for (uint8_t i = 0; i < dirty; i++)
+        if (!card->writeSector(cache_sector + i * fat_sectors, cache)) {
+            cache_sector = 0xFFFFFFFF;
+            dirty = 0;
+            return false;
+        }
+    dirty = 0;
+    return true;
+}
+
+bool VexFat::allocated(uint32_t cluster) {
+    uint32_t bit = cluster - 2;
+    uint8_t const *p;
+
+    if (type != VEX_FAT_EX)
+        return entry(cluster) != 0;
+    // exFAT files without a FAT chain have 0 entries, only the bitmap tells
+    p = sector(bitmap_start + bit / (VEX_SECTOR_SIZE * 8));
+    return !p || (p[(bit / 8) % VEX_SECTOR_SIZE] >> (bit % 8)) & 1;
+}
+
+bool VexFat::sector_used(uint32_t s) {
+    if (type == VEX_FAT_NONE || s < data_start || s >= data_end)
+        return true;
+    return allocated((s - data_start) / sectors_per_cluster + 2);
+}
+
+uint32_t VexFat::run(uint32_t s, uint32_t max) {
+    uint32_t c, n;
+    bool used;
+
+    if (type == VEX_FAT_NONE || s >= data_end)
+        return max;
+    if (s < data_start)
+        return data_start - s < max ? data_start - s : max;
+    used = sector_used(s);
+    c = (s - data_start) / sectors_per_cluster + 2;
+    n = sectors_per_cluster - (s - data_start) % sectors_per_cluster;
+    while (n < max && c + 1 < cluster_count + 2 && allocated(c + 1) == used) {
+        c++;
+        n += sectors_per_cluster;
+    }
+    return n < max ? n : max;
+}
+
+uint32_t VexFat::count_free(uint32_t cluster, uint32_t n) {
+    uint32_t end = cluster_count + 2;
+    uint32_t free = 0;
+    uint8_t const *p;
+
+    if (type == VEX_FAT_NONE || cluster >= end)
+        return 0;
+    if (n < end - cluster)
+        end = cluster + n;
+    if (type != VEX_FAT_EX) {
+        while (cluster < end)
+            free += entry(cluster++) == 0;
+        return free;
+    }
+    // a byte of the bitmap at a time once aligned
+    while (cluster < end) {
+        uint32_t bit = cluster - 2;
+        if (bit % 8 != 0 || end - cluster < 8) {
+            free += !allocated(cluster++);
+            continue;
+        }
+        if ((p = sector(bitmap_start + bit / (VEX_SECTOR_SIZE * 8))) != NULL)
+            for (uint8_t b = p[(bit / 8) % VEX_SECTOR_SIZE]; b != 0xFF; b |= b + 1)
+                free++;
+        cluster += 8;
+    }
+    return free;
+}
@@ -0,0 +1,94 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+// Reads the layout of a FAT16, FAT32 or exFAT volume straight from the card,
+// for the sector level commands. Works whether SdFat managed to mount the
+// volume or not. release() is the only write, for fsck : it changes the cached
+// sector, flush() or reading another sector writes it back.
+
+#ifndef VOLUME_EXPLORER_FAT_H
+#define VOLUME_EXPLORER_FAT_H
+
+#include <Arduino.h>
+#include <SdFat.h>
+
+#define VEX_SECTOR_SIZE 512
+
+enum VexFatType { VEX_FAT_NONE = 0, VEX_FAT_16 = 16, VEX_FAT_32 = 32, VEX_FAT_EX = 64 };
+
+class VexFat {
+    SdCard *card = NULL;
+    uint8_t cache[VEX_SECTOR_SIZE];
+    uint32_t cache_sector;
+    uint8_t dirty = 0; // copies of the cached sector to write
+
+    uint8_t const *sector(uint32_t s);
+    bool begin_fat(uint8_t const *bs);
+    bool begin_exfat(uint8_t const *bs);
+
+  public:
+    uint8_t type = VEX_FAT_NONE;
+    uint32_t part_start;        // boot sector
+    uint32_t fat_start;         // first FAT
+    uint32_t fat_sectors;       // of each FAT
+    uint8_t fat_count;          // copies kept in step, the exFAT one only
+    uint32_t root_start;        // FAT16 root directory, before cluster 2
+    uint32_t root_sectors;
+    uint32_t data_start;        // cluster 2
+    uint32_t data_end;          // past the last cluster
+    uint32_t cluster_count;     // clusters are numbered from 2
+    uint32_t sectors_per_cluster;
+    uint32_t root_cluster;      // FAT32 and exFAT
+    uint32_t bitmap_start;      // exFAT allocation bitmap
+    uint32_t read_errors = 0;   // tells a read error from an 0xFFFFFFFF entry
+
+    // false when no FAT16/32 or exFAT volume is found, type is then NONE
+    bool begin(SdCard *_card);
+
+    // entry of cluster in the FAT, 0xFFFFFFFF on a read error
+    uint32_t entry(uint32_t cluster);
+    bool is_cluster(uint32_t c) {
+        return c >= 2 && c < cluster_count + 2;
+    }
+    // entry values
+    bool end_of_chain(uint32_t v) {
+        return v >= (type == VEX_FAT_16 ? 0xFFF8 : type == VEX_FAT_32 ? 0x0FFFFFF8 : 0xFFFFFFFF);
+    }
+    bool bad(uint32_t v) {
+        return v == (type == VEX_FAT_16 ? 0xFFF7 : type == VEX_FAT_32 ? 0x0FFFFFF7 : 0xFFFFFFF7);
+    }
+    // copy of sector s, through the cache
+    bool read(uint32_t s, uint8_t *dst);
+    // frees cluster in every FAT, or in the exFAT bitmap
+    bool release(uint32_t cluster);
+    bool flush();
+    // read errors count as allocated
+    bool allocated(uint32_t cluster);
+    // metadata, allocated clusters and whatever isn't in the cluster heap
+    bool sector_used(uint32_t s);
+    // how many sectors from s on have the same sector_used() status, at most max
+    uint32_t run(uint32_t s, uint32_t max);
+    // free clusters among the n from cluster on, read errors count as allocated
+    uint32_t count_free(uint32_t cluster, uint32_t n);
+};
+
+#endif
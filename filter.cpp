@@ -0,0 +1,92 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#include "filter.h"
+#include "re.h"
+
+void VexFilter::begin(VexFilterMode _mode, Stream *_out, char const *_pattern, bool _invert) {
+    mode = _mode;
+    out = _out;
+    invert = _invert;
+    pattern[0] = 0;
+    if (_pattern)
+        strlcpy(pattern, _pattern, VOLUME_EXPLORER_FILTER_PATTERN_LEN);
+    line_len = 0;
+    lines = words = bytes = 0;
+    in_word = false;
+}
+
+void VexFilter::flush_line() {
+    line[line_len] = 0;
+    if ((re_match(pattern, line) != -1) != invert) {
+        out->write((const uint8_t *)line, line_len);
+        out->write('\n');
+    }
+    line_len = 0;
+}
+
+size_t VexFilter::write(uint8_t c) {
+    switch (mode) {
+        case VEX_FILTER_CAT:
+            return out->write(c);
+        case VEX_FILTER_GREP:
+            if (c == '\n' || line_len == VOLUME_EXPLORER_FILTER_LINE_LEN - 1)
+                flush_line();
+            if (c != '\n' && c != '\r')
+                line[line_len++] = c;
+            break;
+        case VEX_FILTER_WC:
+            bytes++;
+            if (c == '\n')
+                lines++;
+            if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+                in_word = false;
+            } else if (!in_word) {
+                in_word = true;
+                words++;
+            }
+            break;
+    }
+    return 1;
+}
+
+size_t VexFilter::write(const uint8_t *buf, size_t size) {
+    if (mode == VEX_FILTER_CAT)
+        return out->write(buf, size);
+    for (size_t i = 0; i < size; i++)
+        write(buf[i]);
+    return size;
+}
+
+void VexFilter::end() {
+    switch (mode) {
+        case VEX_FILTER_CAT:
+            break;
+        case VEX_FILTER_GREP:
+            if (line_len > 0)
+                flush_line();
+            break;
+        case VEX_FILTER_WC:
+            out->printf("%lu %lu %lu\n", (unsigned long)lines, (unsigned long)words, (unsigned long)bytes);
+            break;
+    }
+}
@@ -0,0 +1,94 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#ifndef VOLUME_EXPLORER_FILTER_H
+#define VOLUME_EXPLORER_FILTER_H
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include "stats.h"
+
+#define VOLUME_EXPLORER_FILTER_LINE_LEN 256
+#define VOLUME_EXPLORER_FILTER_PATTERN_LEN 64
+
+enum VexFilterMode { VEX_FILTER_CAT, VEX_FILTER_GREP, VEX_FILTER_WC };
+
+// Pipeline stage : bytes written by the previous command are processed on
+// the fly and pushed to the next stage, so no temporary file is needed
+class VexFilter : public Stream {
+    Stream *out;
+    VexFilterMode mode;
+    bool invert;
+    char pattern[VOLUME_EXPLORER_FILTER_PATTERN_LEN];
+    char line[VOLUME_EXPLORER_FILTER_LINE_LEN];
+    int line_len;
+    uint32_t lines, words, bytes;
+    bool in_word;
+
+    void flush_line();
+
+  public:
+    void begin(VexFilterMode _mode, Stream *_out, char const *_pattern = NULL, bool _invert = false);
+    // called once the producing command is done
+    void end();
+
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buf, size_t size);
+    int available() {
+        return 0;
+    }
+    int read() {
+        return -1;
+    }
+    int peek() {
+        return -1;
+    }
+};
+
+// Last stage of a redirected command
+class VexFileSink : public Stream {
+    FsFile *file;
+
+  public:
+    void begin(FsFile *_file) {
+        file = _file;
+    }
+    size_t write(uint8_t c) {
+        return write(&c, 1);
+    }
+    size_t write(const uint8_t *buf, size_t size) {
+        size_t n = file->write(buf, size);
+        VEX_STAT(bytes_written, n);
+        return n;
+    }
+    int available() {
+        return 0;
+    }
+    int read() {
+        return -1;
+    }
+    int peek() {
+        return -1;
+    }
+};
+
+#endif
@@ -0,0 +1,374 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#include "volume_explorer.h"
+
+#ifdef VOLUME_EXPLORER_FRAG_ENABLE
+
+enum { VEX_FRAG_NEXT, VEX_FRAG_FREE, VEX_FRAG_CHAIN, VEX_FRAG_COPY, VEX_FRAG_VERIFY };
+
+void VolumeExplorerSession::frag_start(int id) {
+    char const *inner;
+
+    task_start(id);
+    task.phase = VEX_FRAG_NEXT;
+    task.fragmented = 0;
+    task.all_extents = 0;
+    task.extents_after = 0;
+    task.free_vol = NULL;
+    // frag looks at the free space of the last file, or of the current volume
+    if ((task.vol = resolve(path, &inner)) != NULL)
+        task.fat.begin(task.vol->fs->card());
+}
+
+// frag [file|pattern ...] : extents of each file and its largest contiguous
+// run, from the FAT chains, then how the free space of the volume is split.
+// Without arguments, the free space of the current volume only.
+void VolumeExplorerSession::cmd_frag(int argc, char **argv) {
+    keep_args(argc, argv);
+    frag_start(CMD_FRAG);
+}
+
+// Gets ready to follow the chain of task.src_file
+bool VolumeExplorerSession::frag_open() {
+    char const *inner;
+    VolumeExplorerVolume *vol = resolve(task.src_file, &inner);
+    VexFat &fat = task.fat;
+    uint32_t first, n, cluster_size;
+    bool contiguous;
+
+    if (!vol || !open_file(task.src_f, task.src_file, O_RDONLY)) {
+        error("%s not found", task.shown);
+        return false;
+    }
+    if (task.src_f.isDir()) {
+        error("%s is a directory", task.shown);
+        task.src_f.close();
+        return false;
+    }
+    if (vol != task.vol) {
+        task.vol = vol;
+        fat.begin(vol->fs->card());
+    }
+    cluster_size = fat.sectors_per_cluster * VEX_SECTOR_SIZE;
+    n = fat.type == VEX_FAT_NONE ? 0 : (task.src_f.fileSize() + cluster_size - 1) / cluster_size;
+    first = task.src_f.firstSector();
+    contiguous = task.src_f.isContiguous();
+    task.src_f.close();
+    if (fat.type == VEX_FAT_NONE) {
+        error("no sector access to %s", vol->name);
+        return false;
+    }
+    if (n > 0 && (first < fat.data_start || first >= fat.data_end)) {
+        error("%s : no cluster map", task.shown);
+        return false;
+    }
+    task.clusters = n;
+    task.extents = n > 0;
+    task.run = n > 0;
+    task.largest = 0;
+    task.cluster = (first - fat.data_start) / fat.sectors_per_cluster + 2;
+    // exFAT files allocated in one piece have no FAT chain at all
+    if (contiguous)
+        task.run = n;
+    task.chain_left = contiguous || n == 0 ? 0 : n - 1;
+    return true;
+}
+
+// Follows a few links of the chain, false once it is done. A broken chain
+// is reported and leaves extents at 0.
+bool VolumeExplorerSession::frag_chain() {
+    VexFat &fat = task.fat;
+    uint32_t next;
+
+    for (int i = 0; i < VOLUME_EXPLORER_FRAG_CLUSTERS && task.chain_left > 0; i++, task.chain_left--) {
+        next = fat.entry(task.cluster);
+        if (next < 2 || next >= fat.cluster_count + 2) {
+            error("%s : cluster chain ends %lu clusters early", task.shown, (unsigned long)task.chain_left);
+            task.chain_left = 0;
+            task.extents = 0;
+            return false;
+        }
+        if (next == task.cluster + 1)
+            task.run++;
+        else {
+            if (task.run > task.largest)
+                task.largest = task.run;
+            task.run = 1;
+            task.extents++;
+        }
+        task.cluster = next;
+        task.bytes += fat.sectors_per_cluster * VEX_SECTOR_SIZE;
+    }
+    if (task.chain_left > 0)
+        return true;
+    if (task.run > task.largest)
+        task.largest = task.run;
+    return false;
+}
+
+// Runs of free clusters of task.vol, a slice at a time, false once done
+bool VolumeExplorerSession::frag_free() {
+    VexFat &fat = task.fat;
+    uint32_t end = fat.cluster_count + 2;
+
+    if (task.free_vol != task.vol) {
+        task.free_vol = task.vol;
+        task.free_cluster = 2;
+        task.free_run = 0;
+        task.free_largest = 0;
+        task.free_extents = 0;
+        task.free_total = 0;
+    }
+    for (int i = 0; i < VOLUME_EXPLORER_SCAN_CLUSTERS && task.free_cluster < end; i++, task.free_cluster++) {
+        if (!fat.allocated(task.free_cluster)) {
+            task.free_run++;
+            task.free_total++;
+            continue;
+        }
+        if (task.free_run > 0) {
+            task.free_extents++;
+            if (task.free_run > task.free_largest)
+                task.free_largest = task.free_run;
+        }
+        task.free_run = 0;
+    }
+    if (task.free_cluster < end)
+        return true;
+    if (task.free_run > 0) {
+        task.free_extents++;
+        if (task.free_run > task.free_largest)
+            task.free_largest = task.free_run;
+        task.free_run = 0;
+    }
+    // as good as what the idle scan would have found
+    task.vol->free_clusters = task.free_total;
+    task.vol->cluster_count = fat.cluster_count;
+    task.vol->cluster_size = fat.sectors_per_cluster * VEX_SECTOR_SIZE;
+    task.vol->free_known = true;
+    return false;
+}
+
+bool VolumeExplorerSession::step_frag() {
+    VexFat &fat = task.fat;
+    int n;
+
+    switch (task.phase) {
+        case VEX_FRAG_NEXT:
+            if ((n = next_arg()) > 0 && frag_open())
+                task.phase = VEX_FRAG_CHAIN;
+            if (n >= 0)
+                return true;
+            if (task.count > 0)
+                term->printf("%lu files, %lu fragmented, %lu extents\n", (unsigned long)task.count, (unsigned long)task.fragmented,
+                             (unsigned long)task.all_extents);
+            if (!task.vol || fat.type == VEX_FAT_NONE) {
+                if (status == VEX_STATUS_OK)
+                    error(task.vol ? "no sector access to %s" : "not on a volume", task.vol ? task.vol->name : "");
+                return false;
+            }
+            task.phase = VEX_FRAG_FREE;
+            return true;
+        case VEX_FRAG_CHAIN:
+            if (frag_chain())
+                return true;
+            task.phase = VEX_FRAG_NEXT;
+            if (task.extents == 0 && task.clusters > 0)
+                return true;
+            if (task.count == 0)
+                term->println("extents  largest KB  file");
+            term->printf("%7lu %11lu  %s\n", (unsigned long)task.extents,
+                         (unsigned long)((uint64_t)task.largest * fat.sectors_per_cluster * VEX_SECTOR_SIZE / 1024), task.shown);
+            task.count++;
+            task.all_extents += task.extents;
+            task.fragmented += task.extents > 1;
+            return true;
+        default:
+            if (frag_free())
+                return true;
+            term->printf("%s : %lu MB free in %lu extents, largest %lu MB\n", task.vol->name,
+                         (unsigned long)((uint64_t)task.free_total * fat.sectors_per_cluster / 2048), (unsigned long)task.free_extents,
+                         (unsigned long)((uint64_t)task.free_largest * fat.sectors_per_cluster / 2048));
+            return false;
+    }
+}
+
+// defrag [-n] file|pattern... : copies each fragmented file to a contiguous
+// one next to it, checks the copy then puts it in place of the original.
+// -n only tells which files would be rewritten.
+void VolumeExplorerSession::cmd_defrag(int argc, char **argv) {
+    bool dry_run = strcmp(argv[0], "-n") == 0;
+
+    if (dry_run && argc == 1) {
+        error("defrag [-n] file|pattern...");
+        status = VEX_STATUS_BAD_COMMAND;
+        return;
+    }
+    keep_args(argc - dry_run, &argv[dry_run]);
+    frag_start(CMD_DEFRAG);
+    task.dry_run = dry_run;
+}
+
+// The chain of the current file is known, rewrites it when it is worth it
+void VolumeExplorerSession::defrag_file() {
+    uint32_t cluster_size = task.fat.sectors_per_cluster * VEX_SECTOR_SIZE;
+
+    task.all_extents += task.extents;
+    if (task.extents <= 1 || task.clusters > task.free_largest) {
+        if (task.extents == 1)
+            term->printf("%s : contiguous\n", task.shown);
+        else if (task.extents > 1)
+            term->printf("%s : %lu extents, no free extent of %lu KB\n", task.shown, (unsigned long)task.extents,
+                         (unsigned long)((uint64_t)task.clusters * cluster_size / 1024));
+        task.extents_after += task.extents;
+        return;
+    }
+    // what is left of the largest free extent, the next file may still fit
+    task.free_largest -= task.clusters;
+    if (task.dry_run) {
+        term->printf("%s : %lu extents -> 1, %lu KB to rewrite\n", task.shown, (unsigned long)task.extents,
+                     (unsigned long)((uint64_t)task.clusters * cluster_size / 1024));
+        task.extents_after++;
+        task.count++;
+        return;
+    }
+    task.extents_after += task.extents; // until it is done
+    // both suffixes have the same length
+    if (strlen(task.src_file) + strlen(VOLUME_EXPLORER_DEFRAG_NEW) >= VOLUME_EXPLORER_PATH_LEN) {
+        error("%s : name too long", task.shown);
+        return;
+    }
+    strcpy(task.dst_file, task.src_file);
+    strcat(task.dst_file, VOLUME_EXPLORER_DEFRAG_NEW);
+    if (!check_free(task.src_file, true) || !copy_open(task.src_file, task.dst_file))
+        return;
+    if (!task.src_f.getModifyDateTime(&task.date, &task.time))
+        task.date = 0;
+    if (!task.dst_f.preAllocate(task.src_f.fileSize())) {
+        error("no contiguous space for %s", task.shown);
+        task.prefetch.wait();
+        task.src_f.close();
+        task.dst_f.close();
+        remove_file(task.dst_file);
+        return;
+    }
+    task.phase = VEX_FRAG_COPY;
+}
+
+// Compares a chunk of the copy with the original, false once done
+bool VolumeExplorerSession::defrag_verify() {
+    int n1 = task.src_f.read(task.fbuf[0], VOLUME_EXPLORER_COPY_BUFSIZE);
+    int n2 = task.dst_f.read(task.fbuf[1], VOLUME_EXPLORER_COPY_BUFSIZE);
+
+    if (n1 != n2 || n1 < 0 || memcmp(task.fbuf[0], task.fbuf[1], n1) != 0) {
+        error("%s : the copy differs, file left as it was", task.shown);
+        task.src_f.close();
+        task.dst_f.close();
+        remove_file(task.dst_file);
+        task.count--;
+        return false;
+    }
+    VEX_STAT(bytes_read, 2 * n1);
+    if (n1 > 0)
+        return true;
+    if (task.date != 0)
+        task.dst_f.timestamp(T_WRITE, (task.date >> 9) + 1980, (task.date >> 5) & 15, task.date & 31, task.time >> 11, (task.time >> 5) & 63,
+                             (task.time & 31) * 2);
+    task.src_f.close();
+    task.dst_f.close();
+    defrag_swap();
+    return false;
+}
+
+// SdFat won't rename over an entry : the original is moved aside, the copy
+// takes its name, then the original goes. Whatever the step a power loss
+// stops at, one complete copy of the file is left.
+void VolumeExplorerSession::defrag_swap() {
+    char *old = task.dst; // unused by defrag
+
+    strcpy(old, task.src_file);
+    strcat(old, VOLUME_EXPLORER_DEFRAG_OLD);
+    if (!rename_file(task.src_file, old)) {
+        error("can't rename %s", task.shown);
+        remove_file(task.dst_file);
+        task.count--;
+        return;
+    }
+    if (!rename_file(task.dst_file, task.src_file)) {
+        error("can't rename the copy of %s", task.shown);
+        rename_file(old, task.src_file);
+        remove_file(task.dst_file);
+        task.count--;
+        return;
+    }
+    remove_file(old);
+    task.extents_after -= task.extents - 1;
+    term->printf("%s : %lu extents -> 1\n", task.shown, (unsigned long)task.extents);
+}
+
+bool VolumeExplorerSession::step_defrag() {
+    int n;
+
+    switch (task.phase) {
+        case VEX_FRAG_NEXT:
+            if ((n = next_arg()) > 0 && frag_open())
+                task.phase = task.vol == task.free_vol ? VEX_FRAG_CHAIN : VEX_FRAG_FREE;
+            if (n >= 0)
+                return true;
+            term->printf("%lu files %s, %lu extents -> %lu\n", (unsigned long)task.count, task.dry_run ? "to rewrite" : "rewritten",
+                         (unsigned long)task.all_extents, (unsigned long)task.extents_after);
+            return false;
+        case VEX_FRAG_FREE:
+            if (!frag_free())
+                task.phase = VEX_FRAG_CHAIN;
+            return true;
+        case VEX_FRAG_CHAIN:
+            if (frag_chain())
+                return true;
+            task.phase = VEX_FRAG_NEXT;
+            defrag_file();
+            return true;
+        case VEX_FRAG_COPY:
+            if ((n = copy_step()) > 0)
+                return true;
+            if (n < 0) {
+                task.phase = VEX_FRAG_NEXT;
+                return true;
+            }
+            task.phase = VEX_FRAG_VERIFY;
+            if (!open_file(task.src_f, task.src_file, O_READ) || !open_file(task.dst_f, task.dst_file, O_RDWR)) {
+                error("can't read back %s", task.shown);
+                task.src_f.close();
+                task.dst_f.close();
+                remove_file(task.dst_file);
+                task.count--;
+                task.phase = VEX_FRAG_NEXT;
+            }
+            return true;
+        default:
+            if (!defrag_verify())
+                task.phase = VEX_FRAG_NEXT;
+            return true;
+    }
+}
+
+#endif
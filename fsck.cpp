@@ -0,0 +1,539 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+#include "volume_explorer.h"
+
+#ifdef VOLUME_EXPLORER_FSCK_ENABLE
+
+enum { VEX_FSCK_DIR, VEX_FSCK_CHAIN, VEX_FSCK_LOST };
+
+#define VEX_DIR_ENTRIES (VEX_SECTOR_SIZE / 32)
+#define VEX_FAT_LABEL 0x08
+#define VEX_FAT_DIR 0x10
+#define VEX_FAT_LFN 0x0F
+#define VEX_EXFAT_BITMAP 0x81
+#define VEX_EXFAT_UPCASE 0x82
+#define VEX_EXFAT_FILE 0x85
+#define VEX_EXFAT_STREAM 0xC0
+#define VEX_EXFAT_NAME 0xC1
+#define VEX_EXFAT_NO_FAT_CHAIN 0x02
+
+// names are shown in ASCII, anything else becomes '?'
+static char ascii(uint16_t c) {
+    return c < 0x80 ? c : '?';
+}
+
+// FAT entry at p, true once it is a file or a directory : long name parts
+// are gathered in dst_file, the short name stands when they don't lead to it
+static bool fat_entry(VolumeExplorerTask &t, uint8_t const *p) {
+    static uint8_t const lfn_chars[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+    int max = sizeof(t.dst_file) - 1;
+    uint8_t attr = p[11];
+    int pos, n = 0;
+
+    if (p[0] == 0xE5 || p[0] == '.' || (attr != VEX_FAT_LFN && (attr & VEX_FAT_LABEL))) {
+        t.lfn = 0;
+        return false;
+    }
+    if (attr == VEX_FAT_LFN) {
+        pos = ((p[0] & 0x1F) - 1) * 13;
+        if (pos < 0 || ((p[0] & 0x40) == 0 && (p[0] & 0x1F) != t.lfn - 1)) {
+            t.lfn = 0;
+            return false;
+        }
+        if (p[0] & 0x40)
+            t.dst_file[pos + 13 < max ? pos + 13 : max] = 0;
+        for (int i = 0; i < 13 && pos + i < max; i++) {
+            uint16_t c = vex_get16(&p[lfn_chars[i]]);
+            t.dst_file[pos + i] = ascii(c);
+            if (c == 0)
+                break;
+        }
+        t.lfn = p[0] & 0x1F;
+        return false;
+    }
+    if (t.lfn != 1) {
+        for (int i = 0; i < 8 && p[i] != ' '; i++)
+            t.dst_file[n++] = i == 0 && p[0] == 0x05 ? '?' : p[i];
+        if (p[8] != ' ')
+            t.dst_file[n++] = '.';
+        for (int i = 8; i < 11 && p[i] != ' '; i++)
+            t.dst_file[n++] = p[i];
+        t.dst_file[n] = 0;
+    }
+    t.lfn = 0;
+    t.entry_dir = attr & VEX_FAT_DIR;
+    t.entry_contiguous = false;
+    t.entry_first = vex_get16(&p[26]) | (t.fat.type == VEX_FAT_32 ? (uint32_t)vex_get16(&p[20]) << 16 : 0);
+    t.entry_size = vex_get32(&p[28]);
+    return true;
+}
+
+// exFAT entry at p, true once the entry set of a file is complete, its name
+// is gathered in dst_file. The bitmap and the up-case table own clusters too.
+static bool exfat_entry(VolumeExplorerTask &t, uint8_t const *p) {
+    int max = sizeof(t.dst_file) - 1;
+
+    switch (p[0]) {
+        case VEX_EXFAT_BITMAP:
+        case VEX_EXFAT_UPCASE:
+            strcpy(t.dst_file, p[0] == VEX_EXFAT_BITMAP ? "(bitmap)" : "(upcase)");
+            t.set_left = 0;
+            t.entry_dir = false;
+            t.entry_contiguous = false;
+            t.entry_first = vex_get32(&p[20]);
+            t.entry_size = vex_get64(&p[24]);
+            return true;
+        case VEX_EXFAT_FILE:
+            t.set_left = p[1];
+            t.entry_dir = vex_get16(&p[4]) & VEX_FAT_DIR;
+            t.entry_contiguous = false;
+            t.entry_first = 0;
+            t.entry_size = 0;
+            t.name_len = 0;
+            return false;
+    }
+    // secondary entries only, anything else ends the set
+    if (t.set_left == 0 || (p[0] & 0xC0) != 0xC0) {
+        t.set_left = 0;
+        return false;
+    }
+    if (p[0] == VEX_EXFAT_STREAM) {
+        t.entry_contiguous = p[1] & VEX_EXFAT_NO_FAT_CHAIN;
+        t.entry_first = vex_get32(&p[20]);
+        t.entry_size = vex_get64(&p[24]);
+    } else if (p[0] == VEX_EXFAT_NAME) {
+        for (int i = 2; i < 32 && t.name_len < max && vex_get16(&p[i]) != 0; i += 2)
+            t.dst_file[t.name_len++] = ascii(vex_get16(&p[i]));
+    }
+    t.dst_file[t.name_len] = 0;
+    return --t.set_left == 0;
+}
+
+// fsck [-r] [volume] : checks the FAT chains against the directory tree of
+// volume, the current one by default. A cluster owned twice is cross-linked,
+// an allocated one that nobody owns is lost, -r gives these back and keeps
+// the other sessions from writing to the volume meanwhile. Volumes
+// with more clusters than fbuf has bits are checked a window at a time, the
+// directory tree is walked again for each.
+void VolumeExplorerSession::cmd_fsck(int argc, char **argv) {
+    bool reclaim = argc > 0 && strcmp(argv[0], "-r") == 0;
+    char const *name = argc > reclaim ? argv[reclaim] : NULL;
+    char *b = scratch(VOLUME_EXPLORER_PATH_LEN);
+    char const *inner;
+    VolumeExplorerVolume *vol = NULL;
+    SdCard *card;
+
+    if (!b)
+        return;
+    if (argc > 1 + reclaim) {
+        error("fsck [-r] [volume]");
+        status = VEX_STATUS_BAD_COMMAND;
+        return;
+    }
+    if (name) {
+        if (name[0] == '/')
+            name++;
+        for (uint8_t i = 0; i < shared->volume_count; i++)
+            if (strcmp(shared->volumes[i].name, name) == 0)
+                vol = &shared->volumes[i];
+        if (vol)
+            shared->mount(vol);
+    } else
+        vol = resolve(path, &inner);
+    if (!vol) {
+        error(name ? "no volume %s" : "fsck [-r] volume", name);
+        status = VEX_STATUS_BAD_COMMAND;
+        return;
+    }
+    if (!vol->fs || (card = vol->fs->card()) == NULL || card->sectorCount() == 0 || !task.fat.begin(card)) {
+        error("no sector access to %s", vol->name);
+        return;
+    }
+    snprintf(b, VOLUME_EXPLORER_PATH_LEN, "/%s", vol->name);
+    if (reclaim && redirect_f.isOpen() && resolve(redirect_path, &inner) == vol) {
+        error("fsck -r can't write its report into %s", vol->name);
+        return;
+    }
+    if (reclaim && !check_free(b, true))
+        return;
+    strcpy(task.pattern, b);
+    task_start(CMD_FSCK);
+    task.fsck_vol = vol;
+    task.reclaim = reclaim;
+    task.partial = false;
+    task.files = task.dirs = 0;
+    task.lost = task.lost_runs = task.cross = task.mismatched = task.broken = task.reclaimed = 0;
+    task.window = 2;
+    fsck_window();
+}
+
+// Starts the walk of the directory tree for the clusters of the window
+void VolumeExplorerSession::fsck_window() {
+    VexFat &fat = task.fat;
+    VexFsckDir &d = task.fsck_dirs[0];
+    uint32_t bits = sizeof(task.fbuf) * 8;
+
+    memset(task.fbuf, 0, sizeof(task.fbuf));
+    task.window_end = fat.cluster_count + 2 - task.window > bits ? task.window + bits : fat.cluster_count + 2;
+    snprintf(task.src_file, sizeof(task.src_file), "/%s", task.fsck_vol->name);
+    d.cluster = fat.root_cluster;
+    d.contiguous = false;
+    d.left = 0;
+    d.sector = 0;
+    d.entry = 0;
+    d.path_len = strlen(task.src_file);
+    task.fsck_depth = 1;
+    task.dir_sector = 0xFFFFFFFF;
+    task.lfn = 0;
+    task.set_left = 0;
+    task.crossed = false;
+    task.fsck_phase = VEX_FSCK_DIR;
+    if (fat.type == VEX_FAT_16)
+        return;
+    if (!fat.is_cluster(d.cluster)) {
+        if (task.window == 2)
+            term->printf("%s : bad root cluster %lu\n", task.src_file, (unsigned long)d.cluster);
+        task.broken += task.window == 2;
+        task.partial = true;
+        task.fsck_depth = 0;
+        return;
+    }
+    fsck_own(d.cluster);
+}
+
+// Marks cluster owned by the entry in src_file, false when it already was
+bool VolumeExplorerSession::fsck_own(uint32_t cluster) {
+    uint8_t *bits = (uint8_t *)task.fbuf;
+    uint32_t i = cluster - task.window;
+
+    if (cluster < task.window || cluster >= task.window_end)
+        return true;
+    if ((bits[i / 8] & (1 << (i % 8))) == 0) {
+        bits[i / 8] |= 1 << (i % 8);
+        return true;
+    }
+    if (!task.crossed) {
+        term->printf("%s : cross-linked at cluster %lu\n", task.src_file, (unsigned long)cluster);
+        task.cross++;
+    }
+    // the chain it used to have may be among the lost clusters
+    task.crossed = task.partial = true;
+    return false;
+}
+
+// The entry named in dst_file is complete : a directory is walked into,
+// the chain of a file is followed next
+void VolumeExplorerSession::fsck_entry() {
+    VexFat &fat = task.fat;
+    uint32_t cluster_size = fat.sectors_per_cluster * VEX_SECTOR_SIZE;
+    int len = strlen(task.src_file);
+    bool first_window = task.window == 2;
+    char sbuf[21];
+
+    snprintf(&task.src_file[len], sizeof(task.src_file) - len, "/%s", task.dst_file);
+    task.entry_path_len = len;
+    task.crossed = false;
+    if (first_window) {
+        if (task.entry_dir)
+            task.dirs++;
+        else
+            task.files++;
+    }
+    if (!fat.is_cluster(task.entry_first)) {
+        if (first_window && task.entry_first != 0) {
+            term->printf("%s : bad first cluster %lu\n", task.src_file, (unsigned long)task.entry_first);
+            task.broken++;
+        } else if (first_window && !task.entry_dir && task.entry_size > 0) {
+            term->printf("%s : %s bytes but no cluster\n", task.src_file, u64toa(task.entry_size, sbuf));
+            task.mismatched++;
+        }
+        if (task.entry_first != 0 || (!task.entry_dir && task.entry_size > 0))
+            task.partial = true;
+        task.src_file[len] = 0;
+        return;
+    }
+    if (!task.entry_dir) {
+        task.link = task.entry_first;
+        task.links = 0;
+        task.fsck_phase = VEX_FSCK_CHAIN;
+        return;
+    }
+    if (task.fsck_depth == VOLUME_EXPLORER_FSCK_DEPTH) {
+        if (first_window)
+            term->printf("%s : too deep, not checked\n", task.src_file);
+        task.partial = true;
+        task.src_file[len] = 0;
+        return;
+    }
+    VexFsckDir &d = task.fsck_dirs[task.fsck_depth++];
+    d.cluster = task.entry_first;
+    d.contiguous = task.entry_contiguous;
+    d.left = d.contiguous && task.entry_size > cluster_size ? (task.entry_size - 1) / cluster_size : 0;
+    d.sector = 0;
+    d.entry = 0;
+    d.path_len = len;
+    task.lfn = 0;
+    task.set_left = 0;
+    fsck_own(d.cluster);
+}
+
+// Leaves the directory, false once the root is done
+bool VolumeExplorerSession::fsck_pop() {
+    task.src_file[task.fsck_dirs[--task.fsck_depth].path_len] = 0;
+    task.lfn = 0;
+    task.set_left = 0;
+    return task.fsck_depth > 0;
+}
+
+// Looks at the next entry of the directory being walked, false once the
+// whole tree is done. A directory that can't be read leaves the walk
+// partial.
+bool VolumeExplorerSession::fsck_dir() {
+    VexFat &fat = task.fat;
+    bool first_window = task.window == 2;
+    uint32_t errors = fat.read_errors;
+    uint32_t next, s;
+    uint8_t const *p;
+
+    if (task.fsck_depth == 0)
+        return false;
+    VexFsckDir &d = task.fsck_dirs[task.fsck_depth - 1];
+    if (d.sector == (d.cluster ? fat.sectors_per_cluster : fat.root_sectors)) {
+        if (d.cluster == 0 || (d.contiguous && d.left == 0))
+            return fsck_pop();
+        if (d.contiguous) {
+            next = d.cluster + 1;
+            d.left--;
+        } else {
+            next = fat.entry(d.cluster);
+            if (fat.read_errors != errors) {
+                if (first_window)
+                    term->printf("%s : unreadable FAT at cluster %lu\n", task.src_file, (unsigned long)d.cluster);
+                task.broken += first_window;
+                task.partial = true;
+                return fsck_pop();
+            }
+            if (fat.end_of_chain(next))
+                return fsck_pop();
+        }
+        if (!fat.is_cluster(next)) {
+            if (first_window)
+                term->printf("%s : bad link after cluster %lu\n", task.src_file, (unsigned long)d.cluster);
+            task.broken += first_window;
+            task.partial = true;
+            return fsck_pop();
+        }
+        d.cluster = next;
+        d.sector = 0;
+        task.crossed = false;
+        fsck_own(next);
+    }
+    s = d.cluster ? fat.data_start + (d.cluster - 2) * fat.sectors_per_cluster + d.sector : fat.root_start + d.sector;
+    if (s != task.dir_sector) {
+        if (!fat.read(s, task.dir_buf)) {
+            if (first_window)
+                term->printf("%s : unreadable directory\n", task.src_file);
+            task.broken += first_window;
+            task.partial = true;
+            return fsck_pop();
+        }
+        task.dir_sector = s;
+    }
+    p = &task.dir_buf[d.entry * 32];
+    if (++d.entry == VEX_DIR_ENTRIES) {
+        d.entry = 0;
+        d.sector++;
+    }
+    if (p[0] == 0)
+        return fsck_pop();
+    if (fat.type == VEX_FAT_EX ? exfat_entry(task, p) : fat_entry(task, p))
+        fsck_entry();
+    return true;
+}
+
+// Marks the next cluster of the file, false once the chain is done. Its
+// length is checked against the size of the file in the first window only.
+bool VolumeExplorerSession::fsck_chain() {
+    VexFat &fat = task.fat;
+    uint32_t cluster_size = fat.sectors_per_cluster * VEX_SECTOR_SIZE;
+    uint64_t need = (task.entry_size + cluster_size - 1) / cluster_size;
+    bool first_window = task.window == 2;
+    uint32_t errors = fat.read_errors;
+    uint32_t next;
+    char sbuf[21];
+
+    if (task.entry_contiguous) {
+        // no FAT chain, only the part inside the window matters
+        uint64_t end = task.entry_first + need;
+        for (uint32_t c = task.entry_first > task.window ? task.entry_first : task.window; c < end && c < task.window_end; c++)
+            fsck_own(c);
+        task.links = need;
+    } else {
+        fsck_own(task.link);
+        task.links++;
+        next = fat.entry(task.link);
+        if (fat.read_errors != errors) {
+            if (first_window) {
+                term->printf("%s : unreadable FAT at cluster %lu\n", task.src_file, (unsigned long)task.link);
+                task.broken++;
+            }
+            task.partial = true;
+            task.links = need;
+        } else if (!fat.end_of_chain(next)) {
+            if (fat.is_cluster(next) && task.links < fat.cluster_count) {
+                task.link = next;
+                return true;
+            }
+            if (first_window) {
+                term->printf("%s : bad link after cluster %lu\n", task.src_file, (unsigned long)task.link);
+                task.broken++;
+            }
+            task.partial = true;
+            task.links = need;
+        }
+    }
+    if (task.links != need) {
+        if (first_window) {
+            term->printf("%s : %s bytes in %lu clusters\n", task.src_file, u64toa(task.entry_size, sbuf), (unsigned long)task.links);
+            task.mismatched++;
+        }
+        task.partial = true;
+    }
+    task.src_file[task.entry_path_len] = 0;
+    task.fsck_phase = VEX_FSCK_DIR;
+    return false;
+}
+
+// Looks at the next cluster of the window : allocated and owned by nobody,
+// it is lost, and freed with -r when no chain was found broken
+bool VolumeExplorerSession::fsck_lost() {
+    VexFat &fat = task.fat;
+    uint8_t *bits = (uint8_t *)task.fbuf;
+    uint32_t c = task.link, i = c - task.window;
+    uint32_t errors = fat.read_errors;
+    bool used;
+
+    if (c == task.window_end) {
+        fsck_report();
+        return false;
+    }
+    task.link++;
+    if (bits[i / 8] & (1 << (i % 8)))
+        return true;
+    used = fat.allocated(c) && !fat.bad(fat.entry(c));
+    if (fat.read_errors != errors) {
+        // a run of them is reported once
+        if (task.unreadable_end != c)
+            term->printf("unreadable FAT or bitmap from cluster %lu\n", (unsigned long)c);
+        task.unreadable_end = c + 1;
+        task.broken++;
+        task.partial = true;
+        return true;
+    }
+    if (!used)
+        return true;
+    if (task.lost_end != c)
+        fsck_report();
+    if (task.lost_end == 0)
+        task.lost_start = c;
+    task.lost_end = c + 1;
+    task.lost++;
+    if (task.reclaim && !task.partial) {
+        if (fat.release(c))
+            task.reclaimed++;
+        else {
+            error("write error at cluster %lu, nothing more reclaimed", (unsigned long)c);
+            task.reclaim = false;
+        }
+    }
+    return true;
+}
+
+// Prints the run of lost clusters gathered by fsck_lost()
+void VolumeExplorerSession::fsck_report() {
+    uint32_t cluster_size = task.fat.sectors_per_cluster * VEX_SECTOR_SIZE;
+    char sbuf[21];
+
+    if (task.lost_end == 0)
+        return;
+    if (task.lost_end - task.lost_start == 1)
+        term->printf("lost cluster %lu", (unsigned long)task.lost_start);
+    else
+        term->printf("lost clusters %lu-%lu", (unsigned long)task.lost_start, (unsigned long)(task.lost_end - 1));
+    term->printf(", %s bytes\n", u64toa((uint64_t)(task.lost_end - task.lost_start) * cluster_size, sbuf));
+    task.lost_runs++;
+    task.lost_start = task.lost_end = 0;
+}
+
+// The directory tree, then the lost clusters, for each window
+bool VolumeExplorerSession::step_fsck() {
+    VexFat &fat = task.fat;
+    uint32_t bits = sizeof(task.fbuf) * 8;
+
+    for (int i = 0; i < VOLUME_EXPLORER_FSCK_STEPS; i++) {
+        switch (task.fsck_phase) {
+            case VEX_FSCK_DIR:
+                if (!fsck_dir()) {
+                    task.fsck_phase = VEX_FSCK_LOST;
+                    task.link = task.window;
+                    task.lost_start = task.lost_end = 0;
+                    task.unreadable_end = 0;
+                }
+                break;
+            case VEX_FSCK_CHAIN:
+                fsck_chain();
+                break;
+            case VEX_FSCK_LOST:
+                if (fsck_lost())
+                    break;
+                if (!fat.flush()) {
+                    error("write error, nothing more reclaimed");
+                    task.reclaim = false;
+                }
+                task.window = task.window_end;
+                if (task.window < fat.cluster_count + 2) {
+                    fsck_window();
+                    break;
+                }
+                if (fat.cluster_count > bits)
+                    term->printf("%lu clusters checked in %lu windows\n", (unsigned long)fat.cluster_count,
+                                 (unsigned long)((fat.cluster_count + bits - 1) / bits));
+                term->printf("%lu files, %lu directories : %lu lost clusters in %lu runs, %lu cross-linked, %lu size mismatches, %lu bad "
+                             "chains\n",
+                             (unsigned long)task.files, (unsigned long)task.dirs, (unsigned long)task.lost, (unsigned long)task.lost_runs, (unsigned long)task.cross,
+                             (unsigned long)task.mismatched, (unsigned long)task.broken);
+                if (task.reclaimed) {
+                    term->printf("%lu clusters reclaimed\n", (unsigned long)task.reclaimed);
+                    // SdFat caches the FAT, it starts over
+                    task.fsck_vol->begin();
+                    shared->changed(task.fsck_vol);
+                } else if (task.reclaim && task.partial && task.lost)
+                    term->print("lost clusters kept until the errors above are fixed\n");
+                if (task.lost || task.cross || task.mismatched || task.broken)
+                    status = VEX_STATUS_ERROR;
+                return false;
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,101 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#ifndef VOLUME_EXPLORER_HISTOGRAM_H
+#define VOLUME_EXPLORER_HISTOGRAM_H
+
+#include <Arduino.h>
+
+// 4 buckets per power of two : values are exact up to 7 and within 25% above
+#define VEX_HISTOGRAM_SUB_BITS 2
+#define VEX_HISTOGRAM_BUCKETS (32 << VEX_HISTOGRAM_SUB_BITS)
+
+class VexHistogram {
+    uint32_t buckets[VEX_HISTOGRAM_BUCKETS];
+    uint32_t count;
+    uint32_t min_v;
+    uint32_t max_v;
+
+    static uint8_t index(uint32_t v) {
+        if (v < (2 << VEX_HISTOGRAM_SUB_BITS))
+            return v;
+        uint8_t e = 31 - __builtin_clz(v);
+        uint8_t sub = (v >> (e - VEX_HISTOGRAM_SUB_BITS)) & ((1 << VEX_HISTOGRAM_SUB_BITS) - 1);
+        return ((e - VEX_HISTOGRAM_SUB_BITS + 1) << VEX_HISTOGRAM_SUB_BITS) + sub;
+    }
+
+    static uint32_t upper_bound(uint8_t i) {
+        if (i < (2 << VEX_HISTOGRAM_SUB_BITS))
+            return i;
+        uint8_t e = (i >> VEX_HISTOGRAM_SUB_BITS) + VEX_HISTOGRAM_SUB_BITS - 1;
+        uint32_t sub = i & ((1 << VEX_HISTOGRAM_SUB_BITS) - 1);
+        uint32_t step = 1UL << (e - VEX_HISTOGRAM_SUB_BITS);
+        return (((1UL << VEX_HISTOGRAM_SUB_BITS) + sub) << (e - VEX_HISTOGRAM_SUB_BITS)) + step - 1;
+    }
+
+  public:
+    VexHistogram() {
+        reset();
+    }
+    void reset() {
+        memset(buckets, 0, sizeof(buckets));
+        count = 0;
+        min_v = 0xFFFFFFFF;
+        max_v = 0;
+    }
+    void add(uint32_t v) {
+        buckets[index(v)]++;
+        count++;
+        if (v < min_v)
+            min_v = v;
+        if (v > max_v)
+            max_v = v;
+    }
+    // value under which pct % of the samples fall, rounded up to its bucket
+    uint32_t percentile(uint8_t pct) {
+        uint32_t rank = ((uint64_t)count * pct + 99) / 100;
+        uint32_t seen = 0;
+        if (count == 0)
+            return 0;
+        if (rank == 0)
+            rank = 1;
+        for (int i = 0; i < VEX_HISTOGRAM_BUCKETS; i++) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                uint32_t v = upper_bound(i);
+                return v > max_v ? max_v : v < min_v ? min_v : v;
+            }
+        }
+        return max_v;
+    }
+    uint32_t samples() {
+        return count;
+    }
+    uint32_t min() {
+        return count ? min_v : 0;
+    }
+    uint32_t max() {
+        return max_v;
+    }
+};
+
+#endif
@@ -0,0 +1,116 @@
+/*
+
+    SdFat Volume Explorer - host build
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+    Minimal Arduino core (Print, Stream, timing) implemented over POSIX,
+    enough to compile the explorer unmodified on Linux.
+
+*/
+
+#ifndef VOLUME_EXPLORER_HOST_ARDUINO_H
+#define VOLUME_EXPLORER_HOST_ARDUINO_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define VOLUME_EXPLORER_HOST
+
+#define stricmp strcasecmp
+
+#if !defined(__GLIBC__) || __GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+size_t strlcpy(char *dst, char const *src, size_t size);
+size_t strlcat(char *dst, char const *src, size_t size);
+#endif
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void yield();
+
+class Print {
+  public:
+    virtual ~Print() {
+    }
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size) {
+        size_t n = 0;
+        while (size-- && write(*buf++))
+            n++;
+        return n;
+    }
+    size_t write(const char *str) {
+        return write((const uint8_t *)str, strlen(str));
+    }
+    size_t write(const char *buf, size_t size) {
+        return write((const uint8_t *)buf, size);
+    }
+    virtual void flush() {
+    }
+    int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    size_t print(const char *s) {
+        return write(s);
+    }
+    size_t print(char c) {
+        return write((uint8_t)c);
+    }
+    size_t print(long v) {
+        char b[24];
+        return write(b, snprintf(b, sizeof(b), "%ld", v));
+    }
+    size_t print(int v) {
+        return print((long)v);
+    }
+    size_t print(unsigned long v) {
+        char b[24];
+        return write(b, snprintf(b, sizeof(b), "%lu", v));
+    }
+    size_t print(unsigned int v) {
+        return print((unsigned long)v);
+    }
+    size_t println() {
+        return write("\r\n");
+    }
+    template <typename T> size_t println(T v) {
+        return print(v) + println();
+    }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    size_t readBytes(char *buf, size_t size) {
+        size_t n = 0;
+        int c;
+        while (n < size && (c = read()) >= 0)
+            buf[n++] = c;
+        return n;
+    }
+};
+
+// stdin / stdout or pty, see host/main.cpp
+extern Stream &Serial;
+
+#endif
@@ -0,0 +1,230 @@
+/*
+
+    SdFat Volume Explorer - host build
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+    Subset of the SdFat 2.x API (SdFs, FsVolume, FsFile, SdCard) implemented
+    over POSIX. A volume is a host directory, for instance a FAT/exFAT image
+    mounted with "mount -o loop", and the optional image file itself is the
+    block device returned by card() for sector level commands.
+
+*/
+
+#ifndef VOLUME_EXPLORER_HOST_SDFAT_H
+#define VOLUME_EXPLORER_HOST_SDFAT_H
+
+#include <Arduino.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#define HAS_SDIO_CLASS 1
+#define FIFO_SDIO 0
+#define DMA_SDIO 1
+#define DEDICATED_SPI 0
+#define SHARED_SPI 1
+#define SD_SCK_MHZ(mhz) (1000000UL * (mhz))
+
+#define O_READ O_RDONLY
+#define O_WRITE O_WRONLY
+
+#define T_ACCESS 1
+#define T_CREATE 2
+#define T_WRITE 4
+
+#define FAT_TYPE_EXFAT 64
+#define FAT_TYPE_FAT32 32
+#define FAT_TYPE_FAT16 16
+
+// slot used by the SDIO backend, SPI backends use their chip select pin
+#define SDFAT_HOST_SDIO_SLOT 0xFF
+
+typedef int oflag_t;
+
+// Binds a backend slot to a host directory and optionally a raw image file
+bool sdfat_host_attach(uint8_t slot, char const *root, char const *image = NULL);
+
+class SdioConfig {
+  public:
+    uint8_t options;
+    explicit SdioConfig(uint8_t opt) : options(opt) {
+    }
+};
+
+class SdSpiConfig {
+  public:
+    uint8_t cs_pin;
+    uint8_t options;
+    uint32_t max_sck;
+    SdSpiConfig(uint8_t cs, uint8_t opt, uint32_t sck) : cs_pin(cs), options(opt), max_sck(sck) {
+    }
+};
+
+class SdCard {
+    int fd = -1;
+    uint32_t sectors = 0;
+
+  public:
+    bool begin(char const *image);
+    void end();
+    bool readSector(uint32_t sector, uint8_t *dst) {
+        return readSectors(sector, dst, 1);
+    }
+    bool readSectors(uint32_t sector, uint8_t *dst, size_t ns);
+    bool writeSector(uint32_t sector, const uint8_t *src) {
+        return writeSectors(sector, src, 1);
+    }
+    bool writeSectors(uint32_t sector, const uint8_t *src, size_t ns);
+    bool erase(uint32_t first_sector, uint32_t last_sector);
+    bool syncDevice();
+    uint32_t sectorCount() {
+        return sectors;
+    }
+};
+
+class FsFile;
+
+class FsVolume {
+    friend class FsFile;
+    char root[PATH_MAX];
+    static FsVolume *cwv;
+
+  protected:
+    SdCard sd_card;
+    bool attached = false;
+    bool mount(uint8_t slot);
+
+  public:
+    bool host_path(char const *path, char *out) const;
+
+    bool exists(char const *path);
+    bool remove(char const *path);
+    bool rename(char const *old_path, char const *new_path);
+    bool mkdir(char const *path, bool pFlag = true);
+    bool rmdir(char const *path);
+    void chvol() {
+        cwv = this;
+    }
+    uint8_t fatType() {
+        return 0;
+    }
+    uint32_t clusterCount();
+    uint32_t freeClusterCount();
+    uint32_t bytesPerCluster();
+    uint32_t sectorsPerCluster() {
+        return bytesPerCluster() / 512;
+    }
+};
+
+class SdFs : public FsVolume {
+  public:
+    bool begin(SdioConfig config) {
+        return mount(SDFAT_HOST_SDIO_SLOT);
+    }
+    bool begin(SdSpiConfig config) {
+        return mount(config.cs_pin);
+    }
+    SdCard *card() {
+        return &sd_card;
+    }
+};
+
+class FsFile : public Stream {
+    FsVolume *vol = NULL;
+    int fd = -1;
+    DIR *dir = NULL;
+    char hpath[PATH_MAX];
+    char name[256];
+    int peeked = -1;
+
+    bool open_host(char const *full_path, oflag_t oflag);
+
+  public:
+    FsFile() {
+        hpath[0] = name[0] = 0;
+    }
+    FsFile(const FsFile &from) {
+        hpath[0] = name[0] = 0;
+        *this = from;
+    }
+    FsFile &operator=(const FsFile &from);
+    ~FsFile() {
+        close();
+    }
+
+    bool open(FsVolume *vol, char const *path, oflag_t oflag = O_RDONLY);
+    bool open(char const *path, oflag_t oflag = O_RDONLY) {
+        return open(FsVolume::cwv, path, oflag);
+    }
+    bool openNext(FsFile *dir_file, oflag_t oflag = O_RDONLY);
+    bool close();
+    bool isOpen() const {
+        return fd >= 0 || dir != NULL;
+    }
+    bool isDir() const {
+        return dir != NULL;
+    }
+    bool isFile() const {
+        return fd >= 0;
+    }
+    operator bool() const {
+        return isOpen();
+    }
+    size_t getName(char *buf, size_t size);
+    uint64_t fileSize();
+    // found in the FAT16/32 image attached to the volume, 0 without one
+    uint32_t firstSector();
+    bool isContiguous() {
+        return false;
+    }
+    uint64_t curPosition();
+    bool seekSet(uint64_t pos);
+    bool seekCur(int64_t offset) {
+        return seekSet(curPosition() + offset);
+    }
+    // modification time, in UTC on the host
+    bool getModifyDateTime(uint16_t *pdate, uint16_t *ptime);
+    bool timestamp(uint8_t flags, uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second);
+    // reserves the clusters of an empty file, contiguous on a card
+    bool preAllocate(uint64_t length);
+    bool truncate(uint64_t length);
+    bool truncate() {
+        return truncate(curPosition());
+    }
+    bool sync();
+
+    int read(void *buf, size_t count);
+    int read() override;
+    int peek() override;
+    int available() override;
+    int fgets(char *str, int num, char *delim = NULL);
+
+    using Print::write;
+    size_t write(uint8_t c) override {
+        return write(&c, 1);
+    }
+    size_t write(const uint8_t *buf, size_t size) override {
+        return write((const void *)buf, size);
+    }
+    size_t write(const void *buf, size_t count);
+    void flush() override {
+        sync();
+    }
+};
+
+#endif
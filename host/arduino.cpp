@@ -0,0 +1,88 @@
+/*
+
+    SdFat Volume Explorer - host build
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#include <Arduino.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t start_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t boot_us = start_us();
+
+uint32_t millis() {
+    return (start_us() - boot_us) / 1000;
+}
+
+uint32_t micros() {
+    return start_us() - boot_us;
+}
+
+void delay(uint32_t ms) {
+    usleep(ms * 1000);
+}
+
+void yield() {
+    sched_yield();
+}
+
+#if !defined(__GLIBC__) || __GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+size_t strlcpy(char *dst, char const *src, size_t size) {
+    size_t l = strlen(src);
+    if (size) {
+        size_t n = l < size - 1 ? l : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = 0;
+    }
+    return l;
+}
+
+size_t strlcat(char *dst, char const *src, size_t size) {
+    size_t l = strnlen(dst, size);
+    return l + strlcpy(dst + l, src, size - l);
+}
+#endif
+
+int Print::printf(const char *format, ...) {
+    char sbuf[256];
+    char *b = sbuf;
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(sbuf, sizeof(sbuf), format, args);
+    va_end(args);
+    if (n < 0)
+        return n;
+    if (n >= (int)sizeof(sbuf)) {
+        b = (char *)malloc(n + 1);
+        va_start(args, format);
+        vsnprintf(b, n + 1, format, args);
+        va_end(args);
+    }
+    write((const uint8_t *)b, n);
+    if (b != sbuf)
+        free(b);
+    return n;
+}
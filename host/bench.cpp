@@ -0,0 +1,346 @@
+/*
+
+    SdFat Volume Explorer - host build
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+    vex_bench [-t ms] [-s script] [-v dir]
+
+    Times the explorer hot paths (tokenization, wildcard matching, path
+    expansion, dump / cat formatting, XMODEM loopback) and, with -s, every
+    command of a script replayed against the volume given by -v (a scratch
+    volume is created otherwise). Results are printed as one JSON object per
+    line so they can be collected across releases.
+
+*/
+
+#include "volume_explorer.h"
+#include "xmodem.h"
+#include <chrono>
+#include <condition_variable>
+#include <ftw.h>
+#include <mutex>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+class NullStream : public Stream {
+  public:
+    uint64_t bytes = 0;
+    int available() override {
+        return 0;
+    }
+    int read() override {
+        return -1;
+    }
+    int peek() override {
+        return -1;
+    }
+    size_t write(uint8_t c) override {
+        bytes++;
+        return 1;
+    }
+    size_t write(const uint8_t *buf, size_t size) override {
+        bytes += size;
+        return size;
+    }
+};
+
+static NullStream null_stream;
+Stream &Serial = null_stream;
+
+// One direction of an in-memory serial link
+class Pipe {
+    std::mutex lock;
+    uint8_t buf[4096];
+    size_t head = 0, tail = 0;
+
+  public:
+    int available() {
+        int n;
+        {
+            std::lock_guard<std::mutex> l(lock);
+            n = head - tail;
+        }
+        // xmodem polls available(), let the other end of the link run
+        if (n == 0)
+            std::this_thread::yield();
+        return n;
+    }
+    int read() {
+        std::lock_guard<std::mutex> l(lock);
+        if (head == tail)
+            return -1;
+        return buf[tail++ % sizeof(buf)];
+    }
+    int peek() {
+        std::lock_guard<std::mutex> l(lock);
+        return head == tail ? -1 : buf[tail % sizeof(buf)];
+    }
+    size_t write(const uint8_t *b, size_t size) {
+        size_t n = 0;
+        while (n < size) {
+            std::lock_guard<std::mutex> l(lock);
+            while (n < size && head - tail < sizeof(buf))
+                buf[head++ % sizeof(buf)] = b[n++];
+        }
+        return n;
+    }
+};
+
+class PipeStream : public Stream {
+    Pipe *rx, *tx;
+
+  public:
+    PipeStream(Pipe *_rx, Pipe *_tx) : rx(_rx), tx(_tx) {
+    }
+    int available() override {
+        return rx->available();
+    }
+    int read() override {
+        return rx->read();
+    }
+    int peek() override {
+        return rx->peek();
+    }
+    size_t write(uint8_t c) override {
+        return tx->write(&c, 1);
+    }
+    size_t write(const uint8_t *buf, size_t size) override {
+        return tx->write(buf, size);
+    }
+};
+
+class VolumeExplorerBench {
+  public:
+    static void expand_path(VolumeExplorerSession &vex, char const *pathname, char *out) {
+        vex.expand_path(pathname, out);
+    }
+    static bool file_match(VolumeExplorerSession &vex, char const *filename, char const *pattern) {
+        return vex.file_match(filename, pattern);
+    }
+    // runs a long command to completion
+    static void finish(VolumeExplorerSession &vex) {
+        while (vex.busy())
+            vex.task_update();
+    }
+    static void set_path(VolumeExplorerSession &vex, char const *pathname) {
+        strlcpy(vex.path, pathname, VOLUME_EXPLORER_PATH_LEN);
+    }
+};
+
+typedef std::chrono::steady_clock bench_clock;
+
+static uint32_t min_ms = 200;
+
+static double elapsed_ns(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+}
+
+static void report(char const *name, uint64_t iterations, double ns, uint64_t bytes = 0) {
+    printf("{\"bench\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.1f", name, (unsigned long long)iterations, ns / iterations);
+    if (bytes)
+        printf(",\"bytes_per_sec\":%.0f", bytes / (ns / 1e9));
+    printf("}\n");
+    fflush(stdout);
+}
+
+// Runs fn in batches until min_ms elapsed, fn returns the bytes it processed
+template <typename F> static void run(char const *name, F fn) {
+    uint64_t iterations = 0, bytes = 0, batch = 1;
+    bench_clock::time_point start = bench_clock::now();
+    double ns;
+
+    while ((ns = elapsed_ns(start)) < min_ms * 1e6) {
+        for (uint64_t i = 0; i < batch; i++)
+            bytes += fn();
+        iterations += batch;
+        if (batch < (1 << 16))
+            batch *= 2;
+    }
+    report(name, iterations, ns, bytes);
+}
+
+static void make_file(char const *dir, char const *name, size_t size) {
+    char b[PATH_MAX];
+    snprintf(b, sizeof(b), "%s/%s", dir, name);
+    FILE *f = fopen(b, "wb");
+    uint32_t seed = 0x12345678;
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        // mostly printable text with a few line breaks, so cat has lines to split
+        fputc(i % 61 == 60 ? '\n' : 32 + (seed >> 16) % 95, f);
+    }
+    fclose(f);
+}
+
+static void bench_xmodem(char const *dir, size_t size) {
+    Pipe a_to_b, b_to_a;
+    PipeStream a(&b_to_a, &a_to_b), b(&a_to_b, &b_to_a);
+    char src_path[PATH_MAX], dst_path[PATH_MAX];
+    FsFile src, dst;
+    SdFs vol;
+
+    snprintf(src_path, sizeof(src_path), "%s/xmodem.src", dir);
+    snprintf(dst_path, sizeof(dst_path), "%s/xmodem.dst", dir);
+    sdfat_host_attach(SDFAT_HOST_SDIO_SLOT, dir);
+    make_file(dir, "xmodem.src", size);
+    vol.begin(SdioConfig(FIFO_SDIO));
+    src.open(&vol, "xmodem.src", O_RDONLY);
+    dst.open(&vol, "xmodem.dst", O_WRONLY | O_CREAT | O_TRUNC);
+
+    bench_clock::time_point start = bench_clock::now();
+    std::thread sender([&] {
+        VexXModem xmodem(&a);
+        xmodem.enable_fast_write(true);
+        xmodem.send(src);
+    });
+    VexXModem xmodem(&b);
+    xmodem.enable_fast_write(true);
+    xmodem.receive(dst);
+    sender.join();
+    double ns = elapsed_ns(start);
+    report("xmodem_loopback", (size + XMODEM_BLOCK_SIZE - 1) / XMODEM_BLOCK_SIZE, ns, size);
+    if (dst.fileSize() != src.fileSize())
+        fprintf(stderr, "xmodem_loopback: received %llu bytes out of %llu\n", (unsigned long long)dst.fileSize(),
+                (unsigned long long)src.fileSize());
+    src.close();
+    dst.close();
+    unlink(src_path);
+    unlink(dst_path);
+}
+
+static bool bench_script(VolumeExplorerSession &vex, char const *script) {
+    char line[VOLUME_EXPLORER_CMD_BUFSIZE];
+    FILE *f = fopen(script, "r");
+    int n = 0;
+
+    if (!f) {
+        perror(script);
+        return false;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == 0 || line[0] == '#')
+            continue;
+        bench_clock::time_point start = bench_clock::now();
+        vex.exec_command(line);
+        VolumeExplorerBench::finish(vex);
+        double ns = elapsed_ns(start);
+        n++;
+        printf("{\"bench\":\"script\",\"line\":%d,\"command\":\"", n);
+        for (char *c = line; *c; c++)
+            printf(*c == '"' || *c == '\\' ? "\\%c" : "%c", *c);
+        printf("\",\"ns\":%.0f}\n", ns);
+    }
+    fclose(f);
+    return true;
+}
+
+// Times the hot paths against volume, mounted as /sd0
+static void bench_paths(VolumeExplorerSession &vex, char const *volume) {
+    char names[1000][32];
+    char b[VOLUME_EXPLORER_PATH_LEN];
+
+    run("exec_command", [&] {
+        vex.exec_command("nope /sd0/a/b/c.txt ../d/e.txt f g");
+        return 0;
+    });
+
+    for (int i = 0; i < 1000; i++)
+        snprintf(names[i], sizeof(names[i]), "/sd0/LOG%04d.%s", i, i % 3 ? "TXT" : "BIN");
+    run("file_match_1000", [&] {
+        for (int i = 0; i < 1000; i++)
+            VolumeExplorerBench::file_match(vex, names[i], "/sd0/LOG*.TXT");
+        return 0;
+    });
+
+    VolumeExplorerBench::set_path(vex, "/sd0/d1/d2/d3");
+    run("expand_path", [&] {
+        VolumeExplorerBench::expand_path(vex, "../../d4/../file.txt", b);
+        return 0;
+    });
+    VolumeExplorerBench::set_path(vex, "/sd0");
+
+    char text[] = "text.txt";
+    char *args[] = {text, NULL};
+    run("cmd_dump_64k", [&] {
+        vex.cmd_dump(1, args);
+        VolumeExplorerBench::finish(vex);
+        return 64 * 1024;
+    });
+    run("cmd_cat_64k", [&] {
+        vex.cmd_cat(1, args);
+        VolumeExplorerBench::finish(vex);
+        return 64 * 1024;
+    });
+
+    bench_xmodem(volume, 1024 * 1024);
+}
+
+static int remove_entry(char const *path, struct stat const *st, int type, struct FTW *ftw) {
+    return remove(path);
+}
+
+int main(int argc, char **argv) {
+    char const *script = NULL;
+    char const *volume = NULL;
+    char scratch[] = "/tmp/vex_bench.XXXXXX";
+    bool ok = true;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:s:v:")) != -1) {
+        switch (opt) {
+            case 't':
+                min_ms = atoi(optarg);
+                break;
+            case 's':
+                script = optarg;
+                break;
+            case 'v':
+                volume = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: vex_bench [-t ms] [-s script] [-v dir]\n");
+                return 1;
+        }
+    }
+    if (!volume) {
+        if (!(volume = mkdtemp(scratch))) {
+            perror(scratch);
+            return 1;
+        }
+        mkdir((std::string(volume) + "/d1").c_str(), 0755);
+        make_file(volume, "text.txt", 64 * 1024);
+    }
+    sdfat_host_attach(SDFAT_HOST_SDIO_SLOT, volume);
+    VolumeExplorerMount mount = {.name = "sd0", .backend = VEX_BACKEND_SDIO, .cs_pin = 0};
+    VolumeExplorer explorer(&null_stream, &mount, 1);
+    explorer.init();
+    VolumeExplorerSession &vex = *explorer.session(0);
+    VolumeExplorerBench::finish(vex);
+
+    if (script)
+        ok = bench_script(vex, script);
+    else
+        bench_paths(vex, volume);
+
+    // the scratch volume goes with whatever the script left in it
+    if (volume == scratch)
+        nftw(scratch, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return ok ? 0 : 1;
+}
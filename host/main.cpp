@@ -0,0 +1,228 @@
+/*
+
+    SdFat Volume Explorer - host build
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+    vex_host [-p] [-s] [-l] [-i image] dir [dir ...]
+
+    Each directory is mounted as a volume, the first one on the SDIO backend
+    (/sd0), the next ones on SPI backends (/sd1, ...). -i attaches a raw image
+    file as the first volume's block device. The shell talks over
+    stdin/stdout, or over a pty with -p, whose name is printed on stderr, so
+    lrzsz or a test rig can be attached to it. Each -s adds a session on a
+    pty of its own. -l starts lazily, volumes are mounted by the first command
+    using them.
+
+    It adds an echo command, printing its arguments, as an example of an
+    application command.
+
+*/
+
+#include "volume_explorer.h"
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define VOLUME_EXPLORER_HOST_MAX_VOLUMES VOLUME_EXPLORER_MAX_VOLUMES
+
+static bool echo(Stream *out, int argc, char **argv, void *ctx) {
+    for (int i = 0; i < argc; i++)
+        out->printf(i ? " %s" : "%s", argv[i]);
+    out->print("\n");
+    return true;
+}
+
+class FdStream : public Stream {
+    int in_fd, out_fd;
+    uint8_t in_buf[4096];
+    int in_pos = 0, in_len = 0;
+    bool lf_to_cr;
+
+  public:
+    bool eof = false;
+
+    FdStream(int _in, int _out, bool _lf_to_cr) : in_fd(_in), out_fd(_out), lf_to_cr(_lf_to_cr) {
+    }
+    int available() override {
+        struct pollfd p = {.fd = in_fd, .events = POLLIN, .revents = 0};
+        if (in_pos < in_len)
+            return in_len - in_pos;
+        if (eof || poll(&p, 1, 0) <= 0)
+            return 0;
+        return fetch();
+    }
+    int read() override {
+        int c = peek();
+        if (c >= 0)
+            in_pos++;
+        return c;
+    }
+    int peek() override {
+        if (in_pos == in_len && (eof || fetch() == 0))
+            return -1;
+        return in_buf[in_pos];
+    }
+    size_t write(uint8_t c) override {
+        return write(&c, 1);
+    }
+    size_t write(const uint8_t *buf, size_t size) override {
+        size_t n = 0;
+        while (n < size) {
+            ssize_t r = ::write(out_fd, buf + n, size - n);
+            if (r <= 0)
+                break;
+            n += r;
+        }
+        return n;
+    }
+    int fd() {
+        return in_fd;
+    }
+
+  private:
+    int fetch() {
+        ssize_t r = ::read(in_fd, in_buf, sizeof(in_buf));
+        in_pos = 0;
+        in_len = r > 0 ? r : 0;
+        if (r <= 0)
+            eof = true;
+        if (lf_to_cr)
+            for (int i = 0; i < in_len; i++)
+                if (in_buf[i] == '\n')
+                    in_buf[i] = '\r';
+        return in_len;
+    }
+};
+
+static FdStream serial_stream(STDIN_FILENO, STDOUT_FILENO, false);
+Stream &Serial = serial_stream;
+
+static void usage() {
+    fprintf(stderr, "usage: vex_host [-p] [-s] [-l] [-i image] dir [dir ...]\n");
+    exit(1);
+}
+
+static int open_pty() {
+    struct termios raw;
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+        perror("pty");
+        exit(1);
+    }
+    tcgetattr(fd, &raw);
+    cfmakeraw(&raw);
+    tcsetattr(fd, TCSANOW, &raw);
+    // holding the slave side open lets clients come and go without the
+    // master reading a hangup, the session ends with ctrl/q
+    if (open(ptsname(fd), O_RDWR | O_NOCTTY) < 0) {
+        perror("pty");
+        exit(1);
+    }
+    fprintf(stderr, "%s\n", ptsname(fd));
+    return fd;
+}
+
+// blocks until a session has input, returns false once the first one is closed
+static bool wait_input(FdStream **streams, int count, int timeout_ms) {
+    struct pollfd p[VOLUME_EXPLORER_MAX_SESSIONS];
+
+    for (int i = 0; i < count; i++) {
+        if (streams[i]->available() > 0)
+            return true;
+        p[i] = {.fd = streams[i]->fd(), .events = POLLIN, .revents = 0};
+    }
+    if (streams[0]->eof)
+        return false;
+    poll(p, count, timeout_ms);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    VolumeExplorerMount mounts[VOLUME_EXPLORER_HOST_MAX_VOLUMES];
+    static char names[VOLUME_EXPLORER_HOST_MAX_VOLUMES][VOLUME_EXPLORER_VOLUME_NAME_LEN];
+    char const *image = NULL;
+    bool use_pty = false, lazy = false;
+    int opt, count = 0, sessions = 1;
+    int in_fd = STDIN_FILENO, out_fd = STDOUT_FILENO;
+    struct termios saved, raw;
+    bool restore_tty = false;
+
+    while ((opt = getopt(argc, argv, "psli:")) != -1) {
+        switch (opt) {
+            case 'p':
+                use_pty = true;
+                break;
+            case 's':
+                if (sessions < VOLUME_EXPLORER_MAX_SESSIONS)
+                    sessions++;
+                break;
+            case 'l':
+                lazy = true;
+                break;
+            case 'i':
+                image = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind == argc)
+        usage();
+    for (int i = optind; i < argc && count < VOLUME_EXPLORER_HOST_MAX_VOLUMES; i++, count++) {
+        uint8_t slot = count == 0 ? SDFAT_HOST_SDIO_SLOT : count;
+        sdfat_host_attach(slot, argv[i], count == 0 ? image : NULL);
+        snprintf(names[count], VOLUME_EXPLORER_VOLUME_NAME_LEN, "sd%d", count);
+        mounts[count].name = names[count];
+        mounts[count].backend = count == 0 ? VEX_BACKEND_SDIO : VEX_BACKEND_SPI;
+        mounts[count].cs_pin = slot;
+    }
+
+    if (use_pty) {
+        in_fd = out_fd = open_pty();
+    } else if (isatty(in_fd)) {
+        tcgetattr(in_fd, &saved);
+        raw = saved;
+        raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+        raw.c_iflag &= ~(ICRNL | IXON);
+        tcsetattr(in_fd, TCSANOW, &raw);
+        restore_tty = true;
+    }
+
+    FdStream *streams[VOLUME_EXPLORER_MAX_SESSIONS];
+    streams[0] = new FdStream(in_fd, out_fd, !use_pty && !isatty(in_fd));
+    VolumeExplorer explorer(streams[0], mounts, count);
+    explorer.add_command("echo", 0, VOLUME_EXPLORER_MAX_TOKENS - 1, echo);
+    for (int i = 1; i < sessions; i++) {
+        int fd = open_pty();
+        streams[i] = new FdStream(fd, fd, false);
+        explorer.add_session(streams[i]);
+    }
+
+    explorer.init(lazy);
+    while (!explorer.is_stopped()) {
+        explorer.update();
+        if (!explorer.idle())
+            continue;
+        if (!wait_input(streams, sessions, 10))
+            break;
+    }
+    if (restore_tty)
+        tcsetattr(in_fd, TCSANOW, &saved);
+    return 0;
+}
@@ -0,0 +1,284 @@
+/*
+
+    SdFat Volume Explorer - host build
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#include "rpc_client.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+int VexRpcClient::open_tty(char const *device) {
+    struct termios t;
+    int fd = open(device, O_RDWR | O_NOCTTY);
+
+    if (fd < 0)
+        return -1;
+    if (tcgetattr(fd, &t) == 0) {
+        cfmakeraw(&t);
+        tcsetattr(fd, TCSANOW, &t);
+    }
+    return fd;
+}
+
+bool VexRpcClient::read_bytes(uint8_t *buf, size_t len) {
+    struct pollfd p = {.fd = fd, .events = POLLIN, .revents = 0};
+
+    while (len > 0) {
+        if (poll(&p, 1, VEX_RPC_CLIENT_TIMEOUT_MS) <= 0)
+            return false;
+        ssize_t r = ::read(fd, buf, len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        buf += r;
+        len -= r;
+    }
+    return true;
+}
+
+size_t VexRpcClient::put_path(uint8_t *p, char const *pathname) {
+    size_t l = strlen(pathname) + 1;
+    memcpy(p, pathname, l);
+    return l;
+}
+
+int VexRpcClient::send(uint8_t op, uint8_t const *args, uint16_t len) {
+    size_t size = VEX_RPC_HEADER_SIZE + len + 4;
+    size_t n = 0;
+
+    if (len > VEX_RPC_MAX_LEN - 2)
+        return -1;
+    tx[0] = VEX_RPC_MAGIC;
+    vex_put16(&tx[1], len + 2);
+    tx[3] = seq;
+    tx[4] = op;
+    if (len > 0)
+        memmove(&tx[VEX_RPC_HEADER_SIZE], args, len);
+    vex_put32(&tx[VEX_RPC_HEADER_SIZE + len], vex_crc32(0, &tx[1], len + 4));
+    while (n < size) {
+        ssize_t r = ::write(fd, tx + n, size - n);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        n += r;
+    }
+    return seq++;
+}
+
+// Skips anything before the magic byte, such as the shell prompt
+bool VexRpcClient::recv(int s) {
+    uint16_t len;
+
+    do {
+        if (!read_bytes(rx, 1))
+            return false;
+    } while (rx[0] != VEX_RPC_MAGIC);
+    if (!read_bytes(&rx[1], 2))
+        return false;
+    len = vex_get16(&rx[1]);
+    if (len < 2 || len > VEX_RPC_MAX_LEN || !read_bytes(&rx[3], len + 4))
+        return false;
+    if (vex_crc32(0, &rx[1], len + 2) != vex_get32(&rx[3 + len])) {
+        fprintf(stderr, "vex_rpc: corrupted answer\n");
+        return false;
+    }
+    if (rx[3] != (uint8_t)s) {
+        fprintf(stderr, "vex_rpc: answer %u while waiting for %u\n", rx[3], (uint8_t)s);
+        return false;
+    }
+    status = rx[4];
+    data_len = len - 2;
+    return true;
+}
+
+bool VexRpcClient::hello(uint8_t *version, uint16_t *max_data) {
+    if (!call(VEX_RPC_HELLO, NULL, 0) || data_len < 3)
+        return false;
+    if (version)
+        *version = data[0];
+    if (max_data)
+        *max_data = vex_get16(&data[1]);
+    return true;
+}
+
+bool VexRpcClient::list(char const *pathname, void (*cb)(VexRpcEntry const &e, void *ctx), void *ctx) {
+    uint8_t args[4 + VEX_RPC_MAX_PATH];
+    uint32_t start = 0;
+    uint16_t pos;
+    VexRpcEntry e;
+
+    do {
+        vex_put32(args, start);
+        if (!call(VEX_RPC_LIST, args, 4 + put_path(&args[4], pathname)) || data_len < 1)
+            return false;
+        for (pos = 1; pos + 10 <= data_len; start++) {
+            e.type = data[pos];
+            e.size = vex_get64(&data[pos + 1]);
+            e.name = (char const *)&data[pos + 9];
+            pos += 10 + strlen(e.name);
+            cb(e, ctx);
+        }
+    } while (data[0]);
+    return true;
+}
+
+bool VexRpcClient::stat(char const *pathname, char *type, uint64_t *size) {
+    uint8_t args[VEX_RPC_MAX_PATH];
+
+    if (!call(VEX_RPC_STAT, args, put_path(args, pathname)) || data_len < 9)
+        return false;
+    *type = data[0];
+    *size = vex_get64(&data[1]);
+    return true;
+}
+
+bool VexRpcClient::remove(char const *pathname) {
+    uint8_t args[VEX_RPC_MAX_PATH];
+    return call(VEX_RPC_REMOVE, args, put_path(args, pathname));
+}
+
+bool VexRpcClient::rename(char const *pathname, char const *new_pathname) {
+    uint8_t args[2 * VEX_RPC_MAX_PATH];
+    size_t l = put_path(args, pathname);
+    return call(VEX_RPC_RENAME, args, l + put_path(&args[l], new_pathname));
+}
+
+bool VexRpcClient::sum(char const *pathname, uint32_t *crc, uint64_t *bytes, uint64_t offset, uint64_t len) {
+    uint8_t args[16 + VEX_RPC_MAX_PATH];
+
+    vex_put64(args, offset);
+    vex_put64(&args[8], len);
+    if (!call(VEX_RPC_SUM, args, 16 + put_path(&args[16], pathname)) || data_len < 12)
+        return false;
+    *crc = vex_get32(data);
+    *bytes = vex_get64(&data[4]);
+    return true;
+}
+
+bool VexRpcClient::get(char const *pathname, FILE *out, uint32_t *crc) {
+    uint64_t size;
+    char type;
+
+    *crc = 0;
+    if (!stat(pathname, &type, &size) || type != 'F')
+        return false;
+    return get_range(pathname, 0, size, out, crc);
+}
+
+// Keeps window READ requests in flight, answers come back in order
+bool VexRpcClient::get_range(char const *pathname, uint64_t offset, uint64_t len, FILE *out, uint32_t *crc) {
+    uint8_t args[10 + VEX_RPC_MAX_PATH];
+    uint16_t args_len = 10 + put_path(&args[10], pathname);
+    uint64_t asked = 0, got = 0;
+    int in_flight = 0, next = 0;
+
+    while (got < len) {
+        while (in_flight < window && asked < len) {
+            vex_put64(args, offset + asked);
+            vex_put16(&args[8], len - asked < VEX_RPC_MAX_DATA ? len - asked : VEX_RPC_MAX_DATA);
+            int s = send(VEX_RPC_READ, args, args_len);
+            if (s < 0)
+                return false;
+            if (in_flight++ == 0)
+                next = s;
+            asked += VEX_RPC_MAX_DATA;
+        }
+        if (!recv(next) || status != VEX_RPC_OK || data_len == 0)
+            return false;
+        next = (uint8_t)(next + 1);
+        in_flight--;
+        if (fwrite(data, 1, data_len, out) != data_len)
+            return false;
+        *crc = vex_crc32(*crc, data, data_len);
+        got += data_len;
+    }
+    return true;
+}
+
+bool VexRpcClient::blocks(char const *pathname, uint64_t size, uint32_t block_size, uint32_t *adler, uint32_t *crc) {
+    uint8_t args[14 + VEX_RPC_MAX_PATH];
+    uint16_t args_len = 14 + put_path(&args[14], pathname);
+    uint64_t count = (size + block_size - 1) / block_size, asked = 0, got = 0;
+    uint16_t per_request = VEX_RPC_MAX_DATA / 8;
+    int in_flight = 0, next = 0;
+
+    while (got < count) {
+        while (in_flight < window && asked < count) {
+            vex_put64(args, asked * block_size);
+            vex_put32(&args[8], block_size);
+            vex_put16(&args[12], per_request);
+            int s = send(VEX_RPC_BLOCKS, args, args_len);
+            if (s < 0)
+                return false;
+            if (in_flight++ == 0)
+                next = s;
+            asked += per_request;
+        }
+        if (!recv(next) || status != VEX_RPC_OK || data_len == 0)
+            return false;
+        next = (uint8_t)(next + 1);
+        in_flight--;
+        for (uint16_t pos = 0; pos + 8 <= data_len && got < count; pos += 8, got++) {
+            adler[got] = vex_get32(&data[pos]);
+            crc[got] = vex_get32(&data[pos + 4]);
+        }
+    }
+    return true;
+}
+
+bool VexRpcClient::put(FILE *in, char const *pathname, uint32_t *crc) {
+    uint8_t args[VEX_RPC_MAX_LEN];
+    uint16_t path_len = put_path(&args[9], pathname);
+    uint8_t *chunk = &args[9 + path_len];
+    uint64_t offset = 0;
+    int in_flight = 0, next = 0;
+    bool eof = false;
+
+    *crc = 0;
+    do {
+        while (in_flight < window && !eof) {
+            size_t n = fread(chunk, 1, VEX_RPC_MAX_DATA, in);
+            eof = n < VEX_RPC_MAX_DATA;
+            vex_put64(args, offset);
+            args[8] = offset == 0 ? VEX_RPC_TRUNCATE : 0;
+            int s = send(VEX_RPC_WRITE, args, 9 + path_len + n);
+            if (s < 0)
+                return false;
+            if (in_flight++ == 0)
+                next = s;
+            *crc = vex_crc32(*crc, chunk, n);
+            offset += n;
+        }
+        if (!recv(next) || status != VEX_RPC_OK)
+            return false;
+        next = (uint8_t)(next + 1);
+    } while (--in_flight > 0 || !eof);
+    return !ferror(in);
+}
+
+bool VexRpcClient::quit() {
+    return call(VEX_RPC_QUIT, NULL, 0);
+}
@@ -0,0 +1,92 @@
+/*
+
+    SdFat Volume Explorer - host build
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+    Client side of the binary mode (see ../rpc.h), used by vex_rpc and
+    usable by test rigs : requests are queued with send() and their answers
+    read in order with recv(), so several can be in flight.
+
+*/
+
+#ifndef VOLUME_EXPLORER_RPC_CLIENT_H
+#define VOLUME_EXPLORER_RPC_CLIENT_H
+
+#include "../checksum.h"
+#include "../rpc.h"
+#include <stddef.h>
+#include <stdio.h>
+
+#define VEX_RPC_CLIENT_TIMEOUT_MS 5000
+
+struct VexRpcEntry {
+    char type;
+    uint64_t size;
+    char const *name;
+};
+
+class VexRpcClient {
+    int fd;
+    uint8_t seq = 0;
+    uint8_t tx[VEX_RPC_FRAME_SIZE];
+    uint8_t rx[VEX_RPC_FRAME_SIZE];
+
+    bool read_bytes(uint8_t *buf, size_t len);
+    size_t put_path(uint8_t *p, char const *pathname);
+
+  public:
+    // answer of the last recv()
+    uint8_t status = VEX_RPC_OK;
+    uint8_t *data = &rx[VEX_RPC_HEADER_SIZE];
+    uint16_t data_len;
+    int window = 8; // requests in flight for get / put
+
+    // opens a tty or pty in raw mode, -1 on error
+    static int open_tty(char const *device);
+    explicit VexRpcClient(int _fd) : fd(_fd) {
+    }
+
+    // returns the seq of the request
+    int send(uint8_t op, uint8_t const *args, uint16_t len);
+    // reads the answer to seq, false on timeout, corrupted or unexpected frame
+    bool recv(int seq);
+    bool call(uint8_t op, uint8_t const *args, uint16_t len) {
+        int s = send(op, args, len);
+        return s >= 0 && recv(s) && status == VEX_RPC_OK;
+    }
+
+    bool hello(uint8_t *version = NULL, uint16_t *max_data = NULL);
+    // calls back once per entry, the name is valid during the call only
+    bool list(char const *pathname, void (*cb)(VexRpcEntry const &e, void *ctx), void *ctx);
+    bool stat(char const *pathname, char *type, uint64_t *size);
+    bool remove(char const *pathname);
+    bool rename(char const *pathname, char const *new_pathname);
+    bool sum(char const *pathname, uint32_t *crc, uint64_t *bytes, uint64_t offset = 0, uint64_t len = 0);
+    // whole file transfers, pipelined, the crc of what was transferred is
+    // returned so it can be checked with sum()
+    bool get(char const *pathname, FILE *out, uint32_t *crc);
+    // len bytes from offset appended to out, *crc is updated with them
+    bool get_range(char const *pathname, uint64_t offset, uint64_t len, FILE *out, uint32_t *crc);
+    // adler32 and crc32 of each block of a size bytes file, the last block
+    // may be short, the arrays hold one entry per block
+    bool blocks(char const *pathname, uint64_t size, uint32_t block_size, uint32_t *adler, uint32_t *crc);
+    bool put(FILE *in, char const *pathname, uint32_t *crc);
+    bool quit();
+};
+
+#endif
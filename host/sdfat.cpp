@@ -0,0 +1,515 @@
+/*
+
+    SdFat Volume Explorer - host build
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#include <SdFat.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SDFAT_HOST_MAX_SLOTS 8
+
+static struct {
+    uint8_t slot;
+    char const *root;
+    char const *image;
+} slots[SDFAT_HOST_MAX_SLOTS];
+static int slot_count;
+
+FsVolume *FsVolume::cwv = NULL;
+
+bool sdfat_host_attach(uint8_t slot, char const *root, char const *image) {
+    if (slot_count == SDFAT_HOST_MAX_SLOTS)
+        return false;
+    slots[slot_count].slot = slot;
+    slots[slot_count].root = root;
+    slots[slot_count].image = image;
+    slot_count++;
+    return true;
+}
+
+//---------------------------------------------------------------- SdCard
+
+bool SdCard::begin(char const *image) {
+    struct stat st;
+    end();
+    if (!image)
+        return true;
+    fd = ::open(image, O_RDWR);
+    if (fd < 0 || fstat(fd, &st) != 0)
+        return false;
+    sectors = st.st_size / 512;
+    return true;
+}
+
+void SdCard::end() {
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    sectors = 0;
+}
+
+bool SdCard::readSectors(uint32_t sector, uint8_t *dst, size_t ns) {
+    if (fd < 0 || sector + ns > sectors)
+        return false;
+    return pread(fd, dst, ns * 512, (off_t)sector * 512) == (ssize_t)(ns * 512);
+}
+
+bool SdCard::writeSectors(uint32_t sector, const uint8_t *src, size_t ns) {
+    if (fd < 0 || sector + ns > sectors)
+        return false;
+    return pwrite(fd, src, ns * 512, (off_t)sector * 512) == (ssize_t)(ns * 512);
+}
+
+bool SdCard::erase(uint32_t first_sector, uint32_t last_sector) {
+    uint8_t zero[512] = {0};
+    if (fd < 0 || last_sector >= sectors || first_sector > last_sector)
+        return false;
+    for (uint32_t s = first_sector; s <= last_sector; s++)
+        if (!writeSector(s, zero))
+            return false;
+    return true;
+}
+
+bool SdCard::syncDevice() {
+    return fd < 0 || fsync(fd) == 0;
+}
+
+//---------------------------------------------------------------- FsVolume
+
+bool FsVolume::mount(uint8_t slot) {
+    struct stat st;
+    for (int i = 0; i < slot_count; i++) {
+        if (slots[i].slot != slot)
+            continue;
+        if (stat(slots[i].root, &st) != 0 || !S_ISDIR(st.st_mode))
+            return false;
+        strlcpy(root, slots[i].root, sizeof(root));
+        if (!sd_card.begin(slots[i].image))
+            return false;
+        attached = true;
+        cwv = this;
+        return true;
+    }
+    return false;
+}
+
+// false when the host path doesn't fit, rather than a truncated one
+bool FsVolume::host_path(char const *path, char *out) const {
+    while (*path == '/')
+        path++;
+    return snprintf(out, PATH_MAX, "%s/%s", root, path) < PATH_MAX;
+}
+
+bool FsVolume::exists(char const *path) {
+    char b[PATH_MAX];
+    struct stat st;
+    return attached && host_path(path, b) && stat(b, &st) == 0;
+}
+
+bool FsVolume::remove(char const *path) {
+    char b[PATH_MAX];
+    return attached && host_path(path, b) && unlink(b) == 0;
+}
+
+bool FsVolume::rename(char const *old_path, char const *new_path) {
+    char b1[PATH_MAX], b2[PATH_MAX];
+    struct stat st;
+    // SdFat refuses to replace an existing entry
+    if (!attached || !host_path(old_path, b1) || !host_path(new_path, b2) || stat(b2, &st) == 0)
+        return false;
+    return ::rename(b1, b2) == 0;
+}
+
+bool FsVolume::mkdir(char const *path, bool pFlag) {
+    char b[PATH_MAX];
+    if (!attached || !host_path(path, b))
+        return false;
+    if (pFlag) {
+        for (char *p = b + strlen(root) + 1; *p; p++) {
+            if (*p != '/')
+                continue;
+            *p = 0;
+            if (::mkdir(b, 0755) != 0 && errno != EEXIST)
+                return false;
+            *p = '/';
+        }
+    }
+    return ::mkdir(b, 0755) == 0;
+}
+
+bool FsVolume::rmdir(char const *path) {
+    char b[PATH_MAX];
+    return attached && host_path(path, b) && ::rmdir(b) == 0;
+}
+
+uint32_t FsVolume::clusterCount() {
+    struct statvfs st;
+    return attached && statvfs(root, &st) == 0 ? st.f_blocks : 0;
+}
+
+uint32_t FsVolume::freeClusterCount() {
+    struct statvfs st;
+    return attached && statvfs(root, &st) == 0 ? st.f_bavail : 0;
+}
+
+uint32_t FsVolume::bytesPerCluster() {
+    struct statvfs st;
+    return attached && statvfs(root, &st) == 0 ? st.f_frsize : 0;
+}
+
+//---------------------------------------------------------------- FAT image
+
+// Where files lie in the image attached to a volume, for firstSector() :
+// the directories of a FAT16/32 image are searched for the same path as
+// the host file. exFAT images aren't, their files have no first sector.
+struct HostFat {
+    SdCard *card;
+    bool fat32;
+    uint32_t fat_start, root_start, root_sectors, data_start, spc, root_cluster;
+};
+
+static uint16_t get16(uint8_t const *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(uint8_t const *p) {
+    return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+static bool host_fat_begin(SdCard *card, HostFat &h) {
+    uint8_t bs[512];
+    uint32_t part = 0, fat_size, total, clusters;
+
+    if (!card->readSector(0, bs) || bs[510] != 0x55 || bs[511] != 0xAA)
+        return false;
+    if (bs[0] != 0xEB && bs[0] != 0xE9) {
+        part = get32(&bs[446 + 8]);
+        if (part == 0 || !card->readSector(part, bs))
+            return false;
+    }
+    if (get16(&bs[11]) != 512 || bs[13] == 0 || bs[16] == 0 || memcmp(&bs[3], "EXFAT   ", 8) == 0)
+        return false;
+    fat_size = get16(&bs[22]) ? get16(&bs[22]) : get32(&bs[36]);
+    total = get16(&bs[19]) ? get16(&bs[19]) : get32(&bs[32]);
+    h.card = card;
+    h.spc = bs[13];
+    h.fat_start = part + get16(&bs[14]);
+    h.root_start = h.fat_start + bs[16] * fat_size;
+    h.root_sectors = (get16(&bs[17]) * 32 + 511) / 512;
+    h.data_start = h.root_start + h.root_sectors;
+    clusters = (total - (h.data_start - part)) / h.spc;
+    h.fat32 = clusters >= 65525;
+    h.root_cluster = h.fat32 ? get32(&bs[44]) : 0;
+    return true;
+}
+
+static uint32_t host_fat_next(HostFat &h, uint32_t cluster) {
+    uint8_t s[512];
+    uint32_t offset = cluster * (h.fat32 ? 4 : 2);
+
+    if (!h.card->readSector(h.fat_start + offset / 512, s))
+        return 0;
+    if (!h.fat32)
+        return get16(&s[offset % 512]) >= 0xFFF8 ? 0 : get16(&s[offset % 512]);
+    cluster = get32(&s[offset % 512]) & 0x0FFFFFFF;
+    return cluster >= 0x0FFFFFF8 ? 0 : cluster;
+}
+
+// Looks for name in directory dir, 0 for the root, long names first
+static bool host_fat_find(HostFat &h, uint32_t dir, char const *name, size_t len, uint32_t *cluster, bool *is_dir) {
+    static int const lfn_chars[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+    uint8_t s[512];
+    char lfn[256], short_name[13];
+    uint32_t sector = 0, n = 0;
+    bool fixed_root = dir == 0 && !h.fat32;
+
+    lfn[0] = 0;
+    if (dir == 0)
+        dir = h.root_cluster;
+    while (true) {
+        if (fixed_root) {
+            if (n == h.root_sectors)
+                return false;
+            sector = h.root_start + n;
+        } else {
+            if (n == h.spc) {
+                if ((dir = host_fat_next(h, dir)) < 2)
+                    return false;
+                n = 0;
+            }
+            sector = h.data_start + (dir - 2) * h.spc + n;
+        }
+        n++;
+        if (!h.card->readSector(sector, s))
+            return false;
+        for (uint8_t *e = s; e < s + 512; e += 32) {
+            if (e[0] == 0)
+                return false;
+            if (e[0] == 0xE5) {
+                lfn[0] = 0;
+                continue;
+            }
+            if (e[11] == 0x0F) {
+                int base = ((e[0] & 0x1F) - 1) * 13;
+                if (e[0] & 0x40)
+                    memset(lfn, 0, sizeof(lfn));
+                for (int i = 0; i < 13 && base + i < 255; i++)
+                    if (get16(&e[lfn_chars[i]]) != 0xFFFF && get16(&e[lfn_chars[i]]) != 0)
+                        lfn[base + i] = get16(&e[lfn_chars[i]]) < 0x80 ? e[lfn_chars[i]] : '?';
+                continue;
+            }
+            if (e[11] & 0x08) {
+                lfn[0] = 0;
+                continue;
+            }
+            int l = 0;
+            for (int i = 0; i < 8 && e[i] != ' '; i++)
+                short_name[l++] = e[i];
+            if (e[8] != ' ')
+                short_name[l++] = '.';
+            for (int i = 8; i < 11 && e[i] != ' '; i++)
+                short_name[l++] = e[i];
+            short_name[l] = 0;
+            if ((strlen(lfn) == len && strncasecmp(lfn, name, len) == 0) || (strlen(short_name) == len && strncasecmp(short_name, name, len) == 0)) {
+                *cluster = ((uint32_t)get16(&e[20]) << 16) | get16(&e[26]);
+                *is_dir = (e[11] & 0x10) != 0;
+                return true;
+            }
+            lfn[0] = 0;
+        }
+    }
+}
+
+//---------------------------------------------------------------- FsFile
+
+FsFile &FsFile::operator=(const FsFile &from) {
+    if (this == &from)
+        return *this;
+    close();
+    vol = from.vol;
+    strcpy(hpath, from.hpath);
+    strcpy(name, from.name);
+    if (from.fd >= 0)
+        fd = dup(from.fd);
+    else if (from.dir)
+        dir = opendir(hpath);
+    return *this;
+}
+
+bool FsFile::open_host(char const *full_path, oflag_t oflag) {
+    struct stat st;
+    char const *base;
+
+    close();
+    if (stat(full_path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        if ((oflag & O_ACCMODE) != O_RDONLY)
+            return false;
+        dir = opendir(full_path);
+    } else {
+        fd = ::open(full_path, oflag, 0644);
+    }
+    if (!isOpen())
+        return false;
+    strlcpy(hpath, full_path, sizeof(hpath));
+    base = strrchr(full_path, '/');
+    strlcpy(name, base ? base + 1 : full_path, sizeof(name));
+    return true;
+}
+
+bool FsFile::open(FsVolume *vol, char const *path, oflag_t oflag) {
+    char b[PATH_MAX];
+    if (!vol || !vol->attached || !vol->host_path(path, b) || !open_host(b, oflag))
+        return false;
+    this->vol = vol;
+    return true;
+}
+
+bool FsFile::openNext(FsFile *dir_file, oflag_t oflag) {
+    char b[PATH_MAX];
+    struct dirent *de;
+
+    close();
+    if (!dir_file->dir)
+        return false;
+    while ((de = readdir(dir_file->dir)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        if (snprintf(b, sizeof(b), "%s/%s", dir_file->hpath, de->d_name) >= (int)sizeof(b))
+            continue;
+        if (!open_host(b, oflag))
+            return false;
+        vol = dir_file->vol;
+        return true;
+    }
+    return false;
+}
+
+bool FsFile::close() {
+    if (fd >= 0)
+        ::close(fd);
+    if (dir)
+        closedir(dir);
+    fd = -1;
+    dir = NULL;
+    peeked = -1;
+    return true;
+}
+
+size_t FsFile::getName(char *buf, size_t size) {
+    if (!isOpen() || size == 0)
+        return 0;
+    strlcpy(buf, name, size);
+    return strlen(buf);
+}
+
+uint64_t FsFile::fileSize() {
+    struct stat st;
+    return fd >= 0 && fstat(fd, &st) == 0 ? st.st_size : 0;
+}
+
+uint32_t FsFile::firstSector() {
+    HostFat h;
+    uint32_t cluster = 0;
+    size_t l;
+    char const *p;
+    bool is_dir = true;
+
+    if (!vol || !isOpen() || !host_fat_begin(&vol->sd_card, h))
+        return 0;
+    for (p = hpath + strlen(vol->root); *p == '/'; p++)
+        ;
+    while (*p && is_dir) {
+        l = strcspn(p, "/");
+        if (!host_fat_find(h, cluster, p, l, &cluster, &is_dir))
+            return 0;
+        for (p += l; *p == '/'; p++)
+            ;
+    }
+    return *p == 0 && cluster >= 2 ? h.data_start + (cluster - 2) * h.spc : 0;
+}
+
+bool FsFile::getModifyDateTime(uint16_t *pdate, uint16_t *ptime) {
+    struct stat st;
+    struct tm tm;
+
+    if (!isOpen() || stat(hpath, &st) != 0 || !gmtime_r(&st.st_mtime, &tm) || tm.tm_year < 80)
+        return false;
+    *pdate = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+    *ptime = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+    return true;
+}
+
+bool FsFile::timestamp(uint8_t flags, uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second) {
+    struct tm tm = {};
+    struct timespec ts[2] = {{.tv_sec = 0, .tv_nsec = UTIME_OMIT}, {.tv_sec = 0, .tv_nsec = UTIME_OMIT}};
+
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    tm.tm_min = minute;
+    tm.tm_sec = second;
+    if (flags & T_ACCESS)
+        ts[0].tv_sec = timegm(&tm), ts[0].tv_nsec = 0;
+    if (flags & T_WRITE)
+        ts[1].tv_sec = timegm(&tm), ts[1].tv_nsec = 0;
+    return isOpen() && utimensat(AT_FDCWD, hpath, ts, 0) == 0;
+}
+
+uint64_t FsFile::curPosition() {
+    off_t p = fd >= 0 ? lseek(fd, 0, SEEK_CUR) : 0;
+    return p < 0 ? 0 : p - (peeked >= 0 ? 1 : 0);
+}
+
+bool FsFile::seekSet(uint64_t pos) {
+    peeked = -1;
+    return fd >= 0 && lseek(fd, pos, SEEK_SET) == (off_t)pos;
+}
+
+bool FsFile::preAllocate(uint64_t length) {
+    return fd >= 0 && fileSize() == 0 && fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, length) == 0;
+}
+
+bool FsFile::truncate(uint64_t length) {
+    peeked = -1;
+    return fd >= 0 && ftruncate(fd, length) == 0 && lseek(fd, length, SEEK_SET) == (off_t)length;
+}
+
+bool FsFile::sync() {
+    return fd >= 0 && fsync(fd) == 0;
+}
+
+int FsFile::read(void *buf, size_t count) {
+    uint8_t *b = (uint8_t *)buf;
+    int n = 0;
+    if (fd < 0)
+        return -1;
+    if (peeked >= 0 && count > 0) {
+        *b++ = peeked;
+        peeked = -1;
+        count--;
+        n++;
+    }
+    ssize_t r = ::read(fd, b, count);
+    return r < 0 ? -1 : n + r;
+}
+
+int FsFile::read() {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+int FsFile::peek() {
+    if (peeked < 0)
+        peeked = read();
+    return peeked;
+}
+
+int FsFile::available() {
+    uint64_t n = fileSize() - curPosition();
+    return n > INT_MAX ? INT_MAX : n;
+}
+
+int FsFile::fgets(char *str, int num, char *delim) {
+    int n = 0;
+    int c;
+    while (n < num - 1 && (c = read()) >= 0) {
+        str[n++] = c;
+        if (delim ? strchr(delim, c) != NULL : c == '\n')
+            break;
+    }
+    str[n] = 0;
+    return n;
+}
+
+size_t FsFile::write(const void *buf, size_t count) {
+    if (fd < 0)
+        return 0;
+    if (peeked >= 0) {
+        lseek(fd, -1, SEEK_CUR);
+        peeked = -1;
+    }
+    ssize_t r = ::write(fd, buf, count);
+    return r < 0 ? 0 : r;
+}
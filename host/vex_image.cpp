@@ -0,0 +1,132 @@
+/*
+
+    SdFat Volume Explorer - host build
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+    vex_image stream image
+
+    Rebuilds a card image from what the image command sent (stream, or -
+    for stdin), checking the crc of every range. Free clusters are left as
+    holes of the sparse image file. Ranges that failed their crc or that the
+    card couldn't read are listed, the exit status is then 1.
+
+*/
+
+#include "../checksum.h"
+#include "../image.h"
+#include "../rpc.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SECTOR_SIZE 512
+#define MAX_RANGE 0xFFFF
+
+static bool get(FILE *in, uint8_t *buf, size_t len) {
+    if (fread(buf, 1, len, in) == len)
+        return true;
+    fprintf(stderr, "vex_image: stream truncated\n");
+    return false;
+}
+
+// anything before the header (a command echo) is skipped
+static bool find_header(FILE *in, uint8_t *h) {
+    int c, matched = 0;
+
+    while (matched < 4 && (c = fgetc(in)) != EOF)
+        matched = c == VEX_IMAGE_MAGIC[matched] ? matched + 1 : c == VEX_IMAGE_MAGIC[0];
+    if (matched < 4 || !get(in, h + 4, VEX_IMAGE_HEADER_SIZE - 4)) {
+        fprintf(stderr, "vex_image: no image stream\n");
+        return false;
+    }
+    if (h[4] != VEX_IMAGE_VERSION) {
+        fprintf(stderr, "vex_image: version %u not supported\n", h[4]);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    static uint8_t buf[MAX_RANGE * SECTOR_SIZE];
+    uint8_t h[VEX_IMAGE_HEADER_SIZE], r[12];
+    uint32_t sectors, first, count, crc, failed = 0;
+    FILE *in;
+    int fd;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: vex_image stream|- image\n");
+        return 2;
+    }
+    in = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "rb");
+    if (!in) {
+        perror(argv[1]);
+        return 2;
+    }
+    if (!find_header(in, h))
+        return 1;
+    sectors = vex_get32(&h[6]);
+    fd = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)sectors * SECTOR_SIZE) != 0) {
+        perror(argv[2]);
+        return 2;
+    }
+    printf("%u sectors, %s\n", sectors, h[5] == 64 ? "exFAT" : h[5] == 32 ? "FAT32" : h[5] == 16 ? "FAT16" : "no volume found");
+    while (true) {
+        if (!get(in, r, 1))
+            return 1;
+        switch (r[0]) {
+            case VEX_IMAGE_DATA:
+                if (!get(in, r, 6))
+                    return 1;
+                first = vex_get32(r);
+                count = vex_get16(&r[4]);
+                if (!get(in, buf, count * SECTOR_SIZE) || !get(in, r, 4))
+                    return 1;
+                crc = vex_get32(r);
+                if (crc != vex_crc32(0, buf, count * SECTOR_SIZE)) {
+                    printf("crc error : %u sectors from %u\n", count, first);
+                    failed += count;
+                } else if (first + count > sectors || pwrite(fd, buf, count * SECTOR_SIZE, (off_t)first * SECTOR_SIZE) != count * SECTOR_SIZE) {
+                    perror(argv[2]);
+                    return 1;
+                }
+                break;
+            case VEX_IMAGE_SKIP:
+                if (!get(in, r, 8))
+                    return 1;
+                break;
+            case VEX_IMAGE_BAD:
+                if (!get(in, r, 8))
+                    return 1;
+                printf("unreadable : %u sectors from %u\n", vex_get32(&r[4]), vex_get32(r));
+                failed += vex_get32(&r[4]);
+                break;
+            case VEX_IMAGE_END:
+                if (!get(in, r, 12))
+                    return 1;
+                printf("%u sectors sent, %u skipped, %u unreadable\n", vex_get32(r), vex_get32(&r[4]), vex_get32(&r[8]));
+                close(fd);
+                return failed ? 1 : 0;
+            default:
+                fprintf(stderr, "vex_image: bad record %02X\n", r[0]);
+                return 1;
+        }
+    }
+}
@@ -0,0 +1,139 @@
+/*
+
+    SdFat Volume Explorer - host build
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+    vex_rpc device command [args]
+
+        ls [path]           stat path
+        get remote [local]  put local remote
+        rm path             mv path new_path
+        sum path            hello
+
+    Talks the binary protocol of ../rpc.h to an explorer over a serial
+    device or the pty of vex_host -p, then gives the shell back. get and
+    put check the transfer against a remote sum.
+
+*/
+
+#include "rpc_client.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void usage() {
+    fprintf(stderr, "usage: vex_rpc device ls|stat|get|put|rm|mv|sum|hello [args]\n");
+    exit(1);
+}
+
+static void print_entry(VexRpcEntry const &e, void *ctx) {
+    printf("%c %12" PRIu64 " %s\n", e.type, e.size, e.name);
+}
+
+static bool check_sum(VexRpcClient &rpc, char const *pathname, uint32_t crc) {
+    uint32_t remote;
+    uint64_t bytes;
+
+    if (!rpc.sum(pathname, &remote, &bytes))
+        return false;
+    if (remote != crc) {
+        fprintf(stderr, "vex_rpc: %s crc %08X, expected %08X\n", pathname, remote, crc);
+        return false;
+    }
+    printf("%s %" PRIu64 " bytes crc32 %08X\n", pathname, bytes, crc);
+    return true;
+}
+
+static bool run(VexRpcClient &rpc, int argc, char **argv) {
+    char const *cmd = argv[0];
+    uint32_t crc;
+    uint64_t size;
+    char type;
+    FILE *f;
+    bool ok;
+
+    if (strcmp(cmd, "hello") == 0 && argc == 1) {
+        uint8_t version;
+        uint16_t max_data;
+        if (!rpc.hello(&version, &max_data))
+            return false;
+        printf("version %u, %u bytes per request\n", version, max_data);
+        return true;
+    }
+    if (strcmp(cmd, "ls") == 0 && argc <= 2)
+        return rpc.list(argc == 2 ? argv[1] : "", print_entry, NULL);
+    if (strcmp(cmd, "stat") == 0 && argc == 2) {
+        if (!rpc.stat(argv[1], &type, &size))
+            return false;
+        printf("%c %" PRIu64 "\n", type, size);
+        return true;
+    }
+    if (strcmp(cmd, "rm") == 0 && argc == 2)
+        return rpc.remove(argv[1]);
+    if (strcmp(cmd, "mv") == 0 && argc == 3)
+        return rpc.rename(argv[1], argv[2]);
+    if (strcmp(cmd, "sum") == 0 && argc == 2) {
+        if (!rpc.sum(argv[1], &crc, &size))
+            return false;
+        printf("%08X %" PRIu64 "\n", crc, size);
+        return true;
+    }
+    if (strcmp(cmd, "get") == 0 && (argc == 2 || argc == 3)) {
+        char const *local = argc == 3 ? argv[2] : strrchr(argv[1], '/') ? strrchr(argv[1], '/') + 1 : argv[1];
+        if ((f = fopen(local, "wb")) == NULL) {
+            perror(local);
+            return false;
+        }
+        ok = rpc.get(argv[1], f, &crc);
+        ok = fclose(f) == 0 && ok;
+        return ok && check_sum(rpc, argv[1], crc);
+    }
+    if (strcmp(cmd, "put") == 0 && argc == 3) {
+        if ((f = fopen(argv[1], "rb")) == NULL) {
+            perror(argv[1]);
+            return false;
+        }
+        ok = rpc.put(f, argv[2], &crc);
+        fclose(f);
+        return ok && check_sum(rpc, argv[2], crc);
+    }
+    usage();
+    return false;
+}
+
+int main(int argc, char **argv) {
+    bool ok;
+
+    if (argc < 3)
+        usage();
+    int fd = VexRpcClient::open_tty(argv[1]);
+    if (fd < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    VexRpcClient rpc(fd);
+    ok = run(rpc, argc - 2, argv + 2);
+    if (!ok && rpc.status != VEX_RPC_OK)
+        fprintf(stderr, "vex_rpc: %s failed, status %u\n", argv[2], rpc.status);
+    else if (!ok)
+        fprintf(stderr, "vex_rpc: %s failed\n", argv[2]);
+    rpc.quit();
+    close(fd);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,327 @@
+/*
+
+    SdFat Volume Explorer - host build
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+    vex_sync [-b block_size] device remote_dir local_dir
+
+    Pulls the files of remote_dir that differ from local_dir. The manifest
+    command gives the remote sizes and crcs, files whose local copy matches
+    aren't transferred. For the others the explorer sends the adler32 and
+    crc32 of each block (BLOCKS, see ../rpc.h), the blocks found anywhere in
+    the local copy are reused and only the missing ranges are read, so an
+    appended log costs its new blocks. The local files are hashed and
+    searched by a worker per core.
+
+*/
+
+#include "rpc_client.h"
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#define SHELL_TIMEOUT_MS 120000 // the first manifest of a big tree hashes it all
+#define SHELL_QUIET_MS 200
+#define ADLER_MOD 65521
+
+struct Entry {
+    uint32_t crc;
+    uint64_t size;
+    uint32_t mtime;
+    std::string path;
+    bool same = false;
+};
+
+static int fd;
+static uint32_t block_size = 4096;
+static uint64_t fetched, reused;
+
+// Runs fn(0) ... fn(n - 1) on a worker per core
+template <typename F> static void parallel(int n, F fn) {
+    std::vector<std::thread> workers;
+    std::atomic<int> next(0);
+    int count = std::min<int>(n, std::max(1u, std::thread::hardware_concurrency()));
+
+    for (int w = 0; w < count; w++)
+        workers.emplace_back([&] {
+            for (int i; (i = next++) < n;)
+                fn(i);
+        });
+    for (auto &w : workers)
+        w.join();
+}
+
+// Sends a command to the shell in batch mode, collects the lines it prints
+// up to its status line and returns the status, -1 on timeout
+static int shell(char const *cmd, std::vector<std::string> *lines) {
+    std::string line;
+    struct pollfd p = {.fd = fd, .events = POLLIN, .revents = 0};
+    char c;
+
+    if (write(fd, cmd, strlen(cmd)) < 0 || write(fd, "\r", 1) < 0)
+        return -1;
+    while (poll(&p, 1, SHELL_TIMEOUT_MS) > 0 && read(fd, &c, 1) == 1) {
+        if (c == '\r')
+            continue;
+        if (c != '\n') {
+            line += c;
+            continue;
+        }
+        if (line[0] == '@')
+            return atoi(line.c_str() + line.find(' ') + 1);
+        if (lines)
+            lines->push_back(line);
+        line.clear();
+    }
+    return -1;
+}
+
+// Drops what a previous session left unread, its status lines would be
+// taken for ours
+static void drain() {
+    struct pollfd p = {.fd = fd, .events = POLLIN, .revents = 0};
+    char buf[256];
+
+    while (poll(&p, 1, SHELL_QUIET_MS) > 0 && read(fd, buf, sizeof(buf)) > 0)
+        ;
+}
+
+static bool mkdirs(std::string const &pathname) {
+    for (size_t i = pathname.find('/', 1); i != std::string::npos; i = pathname.find('/', i + 1)) {
+        if (mkdir(pathname.substr(0, i).c_str(), 0755) != 0 && errno != EEXIST)
+            return false;
+    }
+    return true;
+}
+
+static uint32_t file_crc(char const *pathname) {
+    static thread_local uint8_t buf[65536];
+    uint32_t crc = 0;
+    size_t n;
+    FILE *f = fopen(pathname, "rb");
+
+    if (!f)
+        return 0;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        crc = vex_crc32(crc, buf, n);
+    fclose(f);
+    return crc;
+}
+
+// Offsets in the local copy of the remote blocks, -1 when not found.
+// Blocks at the same place are checked first, then the whole copy is
+// searched with a rolling adler32, a segment per worker.
+static void find_blocks(uint8_t const *map, uint64_t size, uint32_t const *adler, uint32_t const *crc, uint64_t remote_size,
+                        std::vector<int64_t> &found) {
+    std::unordered_multimap<uint32_t, uint64_t> wanted;
+    uint64_t count = found.size();
+    uint64_t last;
+    int segments;
+
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t len = std::min<uint64_t>(block_size, remote_size - i * block_size);
+        if (i * block_size + len <= size && vex_adler32(1, &map[i * block_size], len) == adler[i] &&
+            vex_crc32(0, &map[i * block_size], len) == crc[i])
+            found[i] = i * block_size;
+        else if (len == block_size)
+            wanted.emplace(adler[i], i);
+    }
+    if (wanted.empty() || size < block_size)
+        return;
+    last = size - block_size;
+    segments = std::max(1u, std::thread::hardware_concurrency()) * 4;
+    std::vector<std::vector<std::pair<uint64_t, uint64_t>>> hits(segments);
+    parallel(segments, [&](int s) {
+        uint64_t start = last * s / segments + (s > 0), end = last * (s + 1) / segments;
+        uint32_t a = 1, b = 0, x;
+        if (s > 0 && start > end)
+            return;
+        for (uint32_t i = 0; i < block_size; i++) {
+            a = (a + map[start + i]) % ADLER_MOD;
+            b = (b + a) % ADLER_MOD;
+        }
+        for (uint64_t p = start;; p++) {
+            auto range = wanted.equal_range((b << 16) | a);
+            for (auto it = range.first; it != range.second; ++it)
+                if (vex_crc32(0, &map[p], block_size) == crc[it->second])
+                    hits[s].emplace_back(it->second, p);
+            if (p == end)
+                break;
+            // slide by one byte : out goes map[p], in comes map[p + block_size]
+            x = map[p];
+            a = (a + ADLER_MOD - x + map[p + block_size]) % ADLER_MOD;
+            b = (b + ADLER_MOD - (uint64_t)block_size * x % ADLER_MOD + a + ADLER_MOD - 1) % ADLER_MOD;
+        }
+    });
+    for (auto &h : hits)
+        for (auto &hit : h)
+            if (found[hit.first] < 0)
+                found[hit.first] = hit.second;
+}
+
+// Rebuilds the file in tmp from the reused blocks and the missing ranges
+static bool delta(VexRpcClient &rpc, Entry &e, std::string const &remote, std::string const &local, FILE *out, uint32_t *crc) {
+    uint64_t count = (e.size + block_size - 1) / block_size;
+    std::vector<uint32_t> adler(count), bcrc(count);
+    std::vector<int64_t> found(count, -1);
+    uint8_t *map = NULL;
+    struct stat st;
+    int lfd;
+
+    if (!rpc.blocks(remote.c_str(), e.size, block_size, adler.data(), bcrc.data()))
+        return false;
+    if ((lfd = open(local.c_str(), O_RDONLY)) >= 0 && fstat(lfd, &st) == 0 && st.st_size > 0) {
+        map = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, lfd, 0);
+        if (map == MAP_FAILED)
+            map = NULL;
+        else
+            find_blocks(map, st.st_size, adler.data(), bcrc.data(), e.size, found);
+    }
+    bool ok = true;
+    for (uint64_t i = 0; i < count && ok;) {
+        uint64_t len = std::min<uint64_t>(block_size, e.size - i * block_size);
+        if (found[i] >= 0) {
+            ok = fwrite(&map[found[i]], 1, len, out) == len;
+            *crc = vex_crc32(*crc, &map[found[i]], len);
+            reused += len;
+            i++;
+            continue;
+        }
+        uint64_t j = i;
+        while (j < count && found[j] < 0)
+            j++;
+        len = std::min<uint64_t>((j - i) * block_size, e.size - i * block_size);
+        ok = rpc.get_range(remote.c_str(), i * block_size, len, out, crc);
+        fetched += len;
+        i = j;
+    }
+    if (map)
+        munmap(map, st.st_size);
+    if (lfd >= 0)
+        close(lfd);
+    return ok;
+}
+
+static bool pull(VexRpcClient &rpc, Entry &e, std::string const &remote, std::string const &local) {
+    std::string tmp = local + ".vex_sync";
+    struct timespec times[2] = {{(time_t)e.mtime, 0}, {(time_t)e.mtime, 0}};
+    uint32_t crc = 0;
+    bool exists = access(local.c_str(), F_OK) == 0;
+    FILE *out;
+    bool ok;
+
+    if (!mkdirs(local) || (out = fopen(tmp.c_str(), "wb")) == NULL) {
+        perror(tmp.c_str());
+        return false;
+    }
+    ok = exists ? delta(rpc, e, remote, local, out, &crc) : rpc.get_range(remote.c_str(), 0, e.size, out, &crc);
+    if (!exists)
+        fetched += e.size;
+    ok = fclose(out) == 0 && ok;
+    if (ok && crc != e.crc) {
+        fprintf(stderr, "vex_sync: %s crc %08X, expected %08X\n", e.path.c_str(), crc, e.crc);
+        ok = false;
+    }
+    if (!ok || rename(tmp.c_str(), local.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    utimensat(AT_FDCWD, local.c_str(), times, 0);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::string> lines;
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    int opt, st, changed = 0, failed = 0;
+    uint8_t version;
+    char path[VEX_RPC_MAX_PATH];
+
+    while ((opt = getopt(argc, argv, "b:")) != -1) {
+        if (opt == 'b' && atoi(optarg) > 0)
+            block_size = atoi(optarg);
+        else
+            argc = 0;
+    }
+    if (argc - optind != 3) {
+        fprintf(stderr, "usage: vex_sync [-b block_size] device remote_dir local_dir\n");
+        return 2;
+    }
+    char const *remote_dir = argv[optind + 1];
+    char const *local_dir = argv[optind + 2];
+    if ((fd = VexRpcClient::open_tty(argv[optind])) < 0) {
+        perror(argv[optind]);
+        return 2;
+    }
+    drain();
+    snprintf(path, sizeof(path), "manifest %s", remote_dir);
+    if (shell("batch", NULL) < 0 || (st = shell(path, &lines)) != 0) {
+        fprintf(stderr, "vex_sync: %s failed\n", path);
+        return 1;
+    }
+    for (auto &l : lines) {
+        Entry e;
+        int n = 0;
+        if (sscanf(l.c_str(), "%" SCNx32 " %" SCNu64 " %" SCNu32 " %n", &e.crc, &e.size, &e.mtime, &n) == 3 && n > 0) {
+            e.path = l.substr(n);
+            entries.push_back(e);
+        }
+    }
+    // what's already here is hashed in parallel
+    parallel(entries.size(), [&](int i) {
+        struct stat st;
+        std::string local = std::string(local_dir) + "/" + entries[i].path;
+        entries[i].same = stat(local.c_str(), &st) == 0 && (uint64_t)st.st_size == entries[i].size && file_crc(local.c_str()) == entries[i].crc;
+    });
+    VexRpcClient rpc(fd);
+    if (!rpc.hello(&version) || version < 2) {
+        fprintf(stderr, "vex_sync: the explorer has no BLOCKS request\n");
+        return 1;
+    }
+    for (auto &e : entries) {
+        total += e.size;
+        if (e.same)
+            continue;
+        uint64_t f = fetched, r = reused;
+        changed++;
+        if (pull(rpc, e, std::string(remote_dir) + "/" + e.path, std::string(local_dir) + "/" + e.path))
+            printf("%s : %" PRIu64 " bytes fetched, %" PRIu64 " reused\n", e.path.c_str(), fetched - f, reused - r);
+        else {
+            fprintf(stderr, "vex_sync: %s failed\n", e.path.c_str());
+            failed++;
+        }
+    }
+    rpc.quit();
+    if (write(fd, "batch off\r", 10) < 0)
+        failed++;
+    close(fd);
+    printf("%zu files, %d changed, %" PRIu64 " of %" PRIu64 " bytes fetched\n", entries.size(), changed, fetched, total);
+    return failed ? 1 : 0;
+}
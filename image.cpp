@@ -0,0 +1,132 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#include "volume_explorer.h"
+
+#ifdef VOLUME_EXPLORER_IMAGE_ENABLE
+
+// image volume [file] : streams the card of volume to the terminal (or its
+// redirection) or to file, see image.h
+void VolumeExplorerSession::cmd_image(int argc, char **argv) {
+    char const *name = argv[0], *filename = argv[1];
+    uint8_t *h = (uint8_t *)task.fbuf[0];
+    char *b = scratch(VOLUME_EXPLORER_PATH_LEN);
+    char const *inner;
+    VolumeExplorerVolume *vol = NULL;
+
+    if (name[0] == '/')
+        name++;
+    for (uint8_t i = 0; i < shared->volume_count; i++)
+        if (strcmp(shared->volumes[i].name, name) == 0)
+            vol = &shared->volumes[i];
+    // the volume may not be mounted, its card is what matters
+    if (vol)
+        shared->mount(vol);
+    if (!vol || !vol->fs || (task.card = vol->fs->card()) == NULL || task.card->sectorCount() == 0) {
+        error("no sector access to %s", name);
+        return;
+    }
+    if (filename) {
+        if (!b)
+            return;
+        expand_path(filename, b);
+        if (resolve(b, &inner) == vol) {
+            error("can't write the image of %s into it", name);
+            return;
+        }
+        if (!redirect(filename, false))
+            return;
+    }
+    task.fat.begin(task.card);
+    task.sector = 0;
+    task.sector_count = task.card->sectorCount();
+    task.skipped = 0;
+    task.bad = 0;
+    memcpy(h, VEX_IMAGE_MAGIC, 4);
+    h[4] = VEX_IMAGE_VERSION;
+    h[5] = task.fat.type;
+    vex_put32(&h[6], task.sector_count);
+    term->write(h, VEX_IMAGE_HEADER_SIZE);
+    task_start(CMD_IMAGE);
+}
+
+// Sends the next range of used sectors with a multi-block read, or the
+// next run of free clusters as a skip record
+bool VolumeExplorerSession::step_image() {
+    uint8_t *buf = (uint8_t *)task.fbuf;
+    uint8_t r[13];
+    uint32_t left = task.sector_count - task.sector;
+    uint32_t max = sizeof(task.fbuf) / VEX_SECTOR_SIZE;
+    uint32_t n;
+
+    if (left == 0) {
+        r[0] = VEX_IMAGE_END;
+        vex_put32(&r[1], task.count);
+        vex_put32(&r[5], task.skipped);
+        vex_put32(&r[9], task.bad);
+        term->write(r, 13);
+        if (redirect_f.isOpen())
+            console->printf("%lu sectors sent, %lu skipped, %lu unreadable\n", (unsigned long)task.count, (unsigned long)task.skipped,
+                            (unsigned long)task.bad);
+        return false;
+    }
+    if (!task.fat.sector_used(task.sector)) {
+        n = task.fat.run(task.sector, VOLUME_EXPLORER_IMAGE_SKIP_CLUSTERS * task.fat.sectors_per_cluster);
+        if (n > left)
+            n = left;
+        r[0] = VEX_IMAGE_SKIP;
+        vex_put32(&r[1], task.sector);
+        vex_put32(&r[5], n);
+        term->write(r, 9);
+        task.skipped += n;
+        task.sector += n;
+        return true;
+    }
+    n = task.fat.run(task.sector, max < left ? max : left);
+    if (!task.card->readSectors(task.sector, buf, n)) {
+        // retry alone, so that only the failing sectors are lost
+        n = 1;
+        if (!task.card->readSectors(task.sector, buf, 1)) {
+            r[0] = VEX_IMAGE_BAD;
+            vex_put32(&r[1], task.sector);
+            vex_put32(&r[5], 1);
+            term->write(r, 9);
+            task.bad++;
+            task.sector++;
+            return true;
+        }
+    }
+    VEX_STAT(bytes_read, n * VEX_SECTOR_SIZE);
+    r[0] = VEX_IMAGE_DATA;
+    vex_put32(&r[1], task.sector);
+    vex_put16(&r[5], n);
+    term->write(r, 7);
+    term->write(buf, n * VEX_SECTOR_SIZE);
+    vex_put32(r, vex_crc32(0, buf, n * VEX_SECTOR_SIZE));
+    term->write(r, 4);
+    task.count += n;
+    task.bytes += n * VEX_SECTOR_SIZE;
+    task.sector += n;
+    return true;
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+// Stream written by the image command and reassembled by host/vex_image.
+// Records, little endian :
+//
+//   header : "VXIM" | version u8 | fs type u8 | sector count u32
+//   'D'    : first u32 | count u16 | count * 512 bytes | crc32 u32 of the bytes
+//   'S'    : first u32 | count u32, free clusters, not sent
+//   'B'    : first u32 | count u32, sectors the card failed to read
+//   'E'    : sent u32 | skipped u32 | bad u32, end of the stream
+//
+// fs type is 16, 32 or 64 (exFAT), 0 when no volume was found and every
+// sector is sent. Sectors that aren't sent are zeros in the image.
+
+#ifndef VOLUME_EXPLORER_IMAGE_H
+#define VOLUME_EXPLORER_IMAGE_H
+
+#define VEX_IMAGE_MAGIC "VXIM"
+#define VEX_IMAGE_VERSION 1
+#define VEX_IMAGE_HEADER_SIZE 10
+#define VEX_IMAGE_DATA 'D'
+#define VEX_IMAGE_SKIP 'S'
+#define VEX_IMAGE_BAD 'B'
+#define VEX_IMAGE_END 'E'
+
+#endif
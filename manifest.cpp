@@ -0,0 +1,190 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#include "volume_explorer.h"
+
+#ifdef VOLUME_EXPLORER_MANIFEST_ENABLE
+
+// manifest [dir] : one "crc32 size mtime path" line per file of the tree,
+// path relative to dir. The lines are also kept in dir/.manifest, where the
+// crc of a file whose size and mtime didn't change is taken from next time.
+void VolumeExplorerSession::cmd_manifest(int argc, char **argv) {
+    if (argv[0])
+        expand_path(argv[0], task.src_file);
+    else
+        strcpy(task.src_file, path);
+    if (strcmp(task.src_file, "/") == 0 || !is_valid(task.src_file) || !is_dir(task.src_file)) {
+        error("%s is not a directory", task.src_file);
+        return;
+    }
+    snprintf(task.cmp_file, VOLUME_EXPLORER_PATH_LEN, "%s/" VOLUME_EXPLORER_MANIFEST, task.src_file);
+    snprintf(task.dst_file, VOLUME_EXPLORER_PATH_LEN, "%s/" VOLUME_EXPLORER_MANIFEST ".new", task.src_file);
+    if (!check_free(task.cmp_file, true) || !check_free(task.dst_file, true))
+        return;
+    if (!open_file(task.dst_f, task.dst_file, O_WRITE | O_CREAT | O_TRUNC)) {
+        error("unable to write %s", task.dst_file);
+        return;
+    }
+    open_file(task.cmp_f, task.cmp_file, O_RDONLY);
+    open_file(task.tar_dirs[0], task.src_file, O_RDONLY);
+    task_start(CMD_MANIFEST);
+    task.tar_depth = 1;
+    task.base_len = strlen(task.src_file) + 1;
+    task.left = 0;
+    task.hashed = 0;
+}
+
+// Looks name up in the old sidecar, from where the previous lookup stopped
+// since files are walked in the same order, and sets task.sum on a match
+bool VolumeExplorerSession::manifest_cached(char const *name, uint64_t size, uint32_t mtime) {
+    char *line = task.fbuf[1];
+    char *p;
+    uint64_t start, s;
+    bool wrapped = false;
+    uint32_t crc, m;
+    int n;
+
+    if (!task.cmp_f.isOpen())
+        return false;
+    start = task.cmp_f.curPosition();
+    while (!wrapped || task.cmp_f.curPosition() < start) {
+        n = task.cmp_f.fgets(line, VOLUME_EXPLORER_COPY_BUFSIZE);
+        if (n <= 0) {
+            if (wrapped)
+                break;
+            wrapped = true;
+            task.cmp_f.seekSet(0);
+            continue;
+        }
+        VEX_STAT(bytes_read, n);
+        if (line[n - 1] == '\n')
+            line[--n] = 0;
+        crc = strtoul(line, &p, 16);
+        s = strtoull(p, &p, 10);
+        m = strtoul(p, &p, 10);
+        if (*p != ' ' || strcmp(p + 1, name) != 0)
+            continue;
+        if (s != size || m != mtime)
+            return false;
+        task.sum = crc;
+        return true;
+    }
+    return false;
+}
+
+// Prints the line of the file being walked and adds it to the new sidecar
+void VolumeExplorerSession::manifest_line() {
+    VexScratch scope(shared->arena);
+    char *line = scratch(VOLUME_EXPLORER_PATH_LEN + 48);
+    char sbuf[21];
+    int n;
+
+    if (!line)
+        return;
+    n = snprintf(line, VOLUME_EXPLORER_PATH_LEN + 48, "%08lx %s %lu %s\n", (unsigned long)task.sum, u64toa(task.src_f.fileSize(), sbuf),
+                 (unsigned long)task.mtime, &task.src_file[task.base_len]);
+    term->write((uint8_t *)line, n);
+    if (task.dst_f.write(line, n) != (size_t)n)
+        error("%s write error", task.dst_file);
+    VEX_STAT(bytes_written, n);
+    task.count++;
+}
+
+// Replaces the old sidecar with the new one
+bool VolumeExplorerSession::manifest_end() {
+    task.cmp_f.close();
+    task.dst_f.close();
+    if (is_valid(task.cmp_file))
+        remove_file(task.cmp_file);
+    if (!rename_file(task.dst_file, task.cmp_file))
+        error("unable to update %s", task.cmp_file);
+    console->printf("%lu files, %lu hashed\n", (unsigned long)task.count, (unsigned long)task.hashed);
+    return false;
+}
+
+// Hashes the next chunk of the current file, or takes the next entry of
+// the directory being walked
+bool VolumeExplorerSession::step_manifest() {
+    uint16_t date, time;
+    size_t l = strlen(task.src_file);
+    int n;
+
+    if (task.src_f.isOpen()) {
+        if (task.left > 0) {
+            n = task.src_f.read(task.fbuf[0], task.left < VOLUME_EXPLORER_COPY_BUFSIZE ? task.left : VOLUME_EXPLORER_COPY_BUFSIZE);
+            if (n > 0) {
+                VEX_STAT(bytes_read, n);
+                task.sum = vex_crc32(task.sum, task.fbuf[0], n);
+                task.left -= n;
+                task.bytes += n;
+                return true;
+            }
+            error("%s read error", task.src_file);
+        } else
+            manifest_line();
+        task.src_f.close();
+        task.left = 0;
+        *strrchr(task.src_file, '/') = 0;
+        return true;
+    }
+    if (!task.src_f.openNext(&task.tar_dirs[task.tar_depth - 1], O_RDONLY)) {
+        task.tar_dirs[--task.tar_depth].close();
+        if (task.tar_depth == 0)
+            return manifest_end();
+        *strrchr(task.src_file, '/') = 0;
+        return true;
+    }
+    VEX_STAT(dir_entries, 1);
+    // a name filling the buffer may have been cut, skip it rather than
+    // list the wrong path
+    n = l + 2 < VOLUME_EXPLORER_PATH_LEN ? task.src_f.getName(&task.src_file[l + 1], VOLUME_EXPLORER_PATH_LEN - l - 1) : 0;
+    if (n == 0 || l + n + 2 >= VOLUME_EXPLORER_PATH_LEN) {
+        error("%s : entry skipped, name unreadable or too long", task.src_file);
+        task.src_f.close();
+        return true;
+    }
+    task.src_file[l] = '/';
+    if (task.tar_depth == 1 && strncmp(&task.src_file[l + 1], VOLUME_EXPLORER_MANIFEST, strlen(VOLUME_EXPLORER_MANIFEST)) == 0) {
+        task.src_f.close();
+        task.src_file[l] = 0;
+        return true;
+    }
+    if (task.src_f.isDir()) {
+        if (task.tar_depth < VOLUME_EXPLORER_TAR_DEPTH) {
+            task.tar_dirs[task.tar_depth++] = task.src_f;
+        } else {
+            error("%s skipped, too deep", task.src_file);
+            task.src_file[l] = 0;
+        }
+        task.src_f.close();
+        return true;
+    }
+    task.mtime = task.src_f.getModifyDateTime(&date, &time) ? vex_fat_to_unix(date, time) : 0;
+    if (!manifest_cached(&task.src_file[task.base_len], task.src_f.fileSize(), task.mtime)) {
+        task.sum = 0;
+        task.left = task.src_f.fileSize();
+        task.hashed++;
+    }
+    return true;
+}
+
+#endif
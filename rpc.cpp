@@ -0,0 +1,406 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#include "volume_explorer.h"
+
+#ifdef VOLUME_EXPLORER_RPC_ENABLE
+
+void VolumeExplorerSession::cmd_rpc(int argc, char **argv) {
+    rpc_begin();
+}
+
+void VolumeExplorerSession::rpc_begin() {
+    rpc.active = true;
+    rpc.rx_len = 0;
+}
+
+void VolumeExplorerSession::rpc_end() {
+    rpc.f.close();
+    rpc.dir.close();
+    rpc.active = false;
+    report();
+}
+
+// Reads frames and answers them until the budget is spent, what isn't read
+// waits in the stream so the client can pipeline its requests
+void VolumeExplorerSession::rpc_update() {
+    uint32_t t = micros();
+    uint16_t len = 0;
+
+    if (rpc.summing) {
+        rpc_sum_step();
+        return;
+    }
+    while (console->available() > 0) {
+        uint8_t c = console->read();
+        if (rpc.rx_len == 0 && c != VEX_RPC_MAGIC)
+            continue; // resync
+        rpc.rx[rpc.rx_len++] = c;
+        if (rpc.rx_len < 3)
+            continue;
+        len = vex_get16(&rpc.rx[1]);
+        if (len < 2 || len > VEX_RPC_MAX_LEN) {
+            rpc.rx_len = 0;
+            continue;
+        }
+        if (rpc.rx_len < len + 7)
+            continue;
+        rpc.rx_len = 0;
+        rpc_frame();
+        if (!rpc.active || rpc.summing || micros() - t >= task_budget_us)
+            return;
+    }
+}
+
+void VolumeExplorerSession::rpc_reply(uint8_t seq, uint8_t status, uint16_t len) {
+    uint8_t *f = rpc.tx;
+
+    f[0] = VEX_RPC_MAGIC;
+    vex_put16(&f[1], len + 2);
+    f[3] = seq;
+    f[4] = status;
+    vex_put32(&f[VEX_RPC_HEADER_SIZE + len], vex_crc32(0, &f[1], len + 4));
+    console->write(f, VEX_RPC_HEADER_SIZE + len + 4);
+#ifdef VOLUME_EXPLORER_STATS_ENABLE
+    stats.end_command(micros() - command_start_us);
+#endif
+}
+
+// Expands the zero terminated path found at args[pos]
+bool VolumeExplorerSession::rpc_path(uint8_t const *args, uint16_t len, uint16_t &pos, char *b) {
+    char const *p = (char const *)&args[pos];
+    size_t l;
+
+    if (pos >= len)
+        return false;
+    l = strnlen(p, len - pos);
+    if (l == (size_t)(len - pos) || l + strlen(path) + 2 > VOLUME_EXPLORER_PATH_LEN)
+        return false;
+    expand_path(p, b);
+    pos += l + 1;
+    return true;
+}
+
+// Keeps the file open between READ or WRITE ranges of the same file
+uint8_t VolumeExplorerSession::rpc_file(char const *pathname, bool write) {
+    char const *inner;
+
+    if (rpc.f.isOpen() && strcmp(rpc.f_path, pathname) == 0 && (rpc.f_write || !write)) {
+        if (write) // every range changes the volume
+            shared->changed(resolve(pathname, &inner));
+        return VEX_RPC_OK;
+    }
+    rpc.f.close();
+    if (in_use(pathname, write))
+        return VEX_RPC_IN_USE;
+    if (!open_file(rpc.f, pathname, write ? O_RDWR | O_CREAT : O_RDONLY))
+        return write ? VEX_RPC_IO_ERROR : VEX_RPC_NOT_FOUND;
+    strcpy(rpc.f_path, pathname);
+    rpc.f_write = write;
+    return VEX_RPC_OK;
+}
+
+void VolumeExplorerSession::rpc_frame() {
+    VexScratch scope(shared->arena);
+    char *b1 = (char *)shared->arena.alloc(VOLUME_EXPLORER_PATH_LEN);
+    char *b2 = (char *)shared->arena.alloc(VOLUME_EXPLORER_PATH_LEN);
+    uint8_t *f = rpc.rx;
+    uint16_t len = vex_get16(&f[1]);
+    uint8_t seq = f[3];
+    uint8_t op = f[4];
+    uint8_t const *args = &f[VEX_RPC_HEADER_SIZE];
+    uint8_t *out = &rpc.tx[VEX_RPC_HEADER_SIZE];
+    uint16_t args_len = len - 2;
+    uint16_t pos, out_len = 0;
+    uint8_t st = VEX_RPC_OK;
+    uint64_t offset, size;
+    int n;
+
+    command_start_us = micros();
+    if (vex_crc32(0, &f[1], len + 2) != vex_get32(&f[3 + len])) {
+        rpc_reply(seq, VEX_RPC_BAD_CRC, 0);
+        return;
+    }
+    if (!b1 || !b2) {
+        rpc_reply(seq, VEX_RPC_IO_ERROR, 0);
+        return;
+    }
+    // another handle on the file would see a stale size
+    if (op != VEX_RPC_READ && op != VEX_RPC_WRITE)
+        rpc.f.close();
+    switch (op) {
+        case VEX_RPC_HELLO:
+            out[0] = VEX_RPC_VERSION;
+            vex_put16(&out[1], VEX_RPC_MAX_DATA);
+            out_len = 3;
+            break;
+        case VEX_RPC_LIST:
+            st = rpc_list(args, args_len, out_len);
+            break;
+        case VEX_RPC_STAT:
+            pos = 0;
+            if (!rpc_path(args, args_len, pos, b1))
+                st = VEX_RPC_BAD_REQUEST;
+            else if (strcmp(b1, "/") == 0 || is_dir(b1)) {
+                out[0] = 'D';
+                vex_put64(&out[1], 0);
+                out_len = 9;
+            } else if (!open_file(rpc.f, b1, O_RDONLY))
+                st = VEX_RPC_NOT_FOUND;
+            else {
+                out[0] = 'F';
+                vex_put64(&out[1], rpc.f.fileSize());
+                out_len = 9;
+                rpc.f.close();
+            }
+            break;
+        case VEX_RPC_READ:
+            pos = 10;
+            if (args_len < pos || !rpc_path(args, args_len, pos, b1))
+                st = VEX_RPC_BAD_REQUEST;
+            else if ((st = rpc_file(b1, false)) == VEX_RPC_OK) {
+                size = vex_get16(&args[8]);
+                if (size > VEX_RPC_MAX_DATA)
+                    size = VEX_RPC_MAX_DATA;
+                if (!rpc.f.seekSet(vex_get64(args)) || (n = rpc.f.read(out, size)) < 0)
+                    st = VEX_RPC_IO_ERROR;
+                else {
+                    VEX_STAT(bytes_read, n);
+                    out_len = n;
+                }
+            }
+            break;
+        case VEX_RPC_WRITE:
+            pos = 9;
+            if (args_len < pos || !rpc_path(args, args_len, pos, b1))
+                st = VEX_RPC_BAD_REQUEST;
+            else if ((st = rpc_file(b1, true)) == VEX_RPC_OK) {
+                offset = vex_get64(args);
+                if ((args[8] & VEX_RPC_TRUNCATE) && !rpc.f.truncate(offset))
+                    st = VEX_RPC_IO_ERROR;
+                else if (!rpc.f.seekSet(offset) || (n = rpc.f.write(&args[pos], args_len - pos)) != args_len - pos)
+                    st = VEX_RPC_IO_ERROR;
+                else {
+                    VEX_STAT(bytes_written, n);
+                    vex_put16(out, n);
+                    out_len = 2;
+                }
+            }
+            break;
+        case VEX_RPC_REMOVE:
+            pos = 0;
+            if (!rpc_path(args, args_len, pos, b1))
+                st = VEX_RPC_BAD_REQUEST;
+            else if (!is_valid(b1))
+                st = VEX_RPC_NOT_FOUND;
+            else if (in_use(b1, true))
+                st = VEX_RPC_IN_USE;
+            else if (!remove_file(b1))
+                st = VEX_RPC_IO_ERROR;
+            break;
+        case VEX_RPC_RENAME:
+            pos = 0;
+            if (!rpc_path(args, args_len, pos, b1) || !rpc_path(args, args_len, pos, b2))
+                st = VEX_RPC_BAD_REQUEST;
+            else if (!is_valid(b1))
+                st = VEX_RPC_NOT_FOUND;
+            else if (in_use(b1, true) || in_use(b2, true))
+                st = VEX_RPC_IN_USE;
+            else if (!rename_file(b1, b2))
+                st = VEX_RPC_IO_ERROR;
+            break;
+        case VEX_RPC_SUM:
+            pos = 16;
+            if (args_len < pos || !rpc_path(args, args_len, pos, b1))
+                st = VEX_RPC_BAD_REQUEST;
+            else if (is_dir(b1))
+                st = VEX_RPC_NOT_FOUND;
+            else if ((st = rpc_file(b1, false)) == VEX_RPC_OK) {
+                offset = vex_get64(args);
+                size = rpc.f.fileSize();
+                rpc.sum_left = offset < size ? size - offset : 0;
+                if (vex_get64(&args[8]) != 0 && vex_get64(&args[8]) < rpc.sum_left)
+                    rpc.sum_left = vex_get64(&args[8]);
+                rpc.sum_seq = seq;
+                rpc.sum_crc = 0;
+                rpc.sum_bytes = 0;
+                rpc.block_size = 0;
+                if (!rpc.f.seekSet(offset < size ? offset : size))
+                    st = VEX_RPC_IO_ERROR;
+                else {
+                    rpc.summing = true;
+                    return; // answered by rpc_sum_step()
+                }
+            }
+            break;
+        case VEX_RPC_BLOCKS:
+            pos = 14;
+            if (args_len < pos || !rpc_path(args, args_len, pos, b1) || vex_get32(&args[8]) == 0)
+                st = VEX_RPC_BAD_REQUEST;
+            else if (is_dir(b1))
+                st = VEX_RPC_NOT_FOUND;
+            else if ((st = rpc_file(b1, false)) == VEX_RPC_OK) {
+                offset = vex_get64(args);
+                size = rpc.f.fileSize();
+                rpc.block_size = vex_get32(&args[8]);
+                n = vex_get16(&args[12]);
+                if (n > VEX_RPC_MAX_DATA / 8)
+                    n = VEX_RPC_MAX_DATA / 8;
+                rpc.sum_left = offset < size ? size - offset : 0;
+                if ((uint64_t)rpc.block_size * n < rpc.sum_left)
+                    rpc.sum_left = (uint64_t)rpc.block_size * n;
+                rpc.block_left = rpc.block_size;
+                rpc.sum_seq = seq;
+                rpc.sum_crc = 0;
+                rpc.sum_adler = 1;
+                rpc.sum_bytes = 0;
+                rpc.out_len = 0;
+                if (!rpc.f.seekSet(offset < size ? offset : size))
+                    st = VEX_RPC_IO_ERROR;
+                else {
+                    rpc.summing = true;
+                    return;
+                }
+            }
+            break;
+        case VEX_RPC_QUIT:
+            rpc_reply(seq, VEX_RPC_OK, 0);
+            rpc_end();
+            return;
+        default:
+            st = VEX_RPC_BAD_REQUEST;
+    }
+    rpc_reply(seq, st, out_len);
+}
+
+uint8_t VolumeExplorerSession::rpc_list(uint8_t const *args, uint16_t len, uint16_t &out_len) {
+    char *b = (char *)shared->arena.alloc(VOLUME_EXPLORER_PATH_LEN);
+    char const *inner;
+    uint8_t *out = &rpc.tx[VEX_RPC_HEADER_SIZE];
+    uint16_t pos = 4;
+    uint32_t start;
+    VolumeExplorerVolume *vol;
+
+    if (!b)
+        return VEX_RPC_IO_ERROR;
+    if (len < pos || !rpc_path(args, len, pos, b))
+        return VEX_RPC_BAD_REQUEST;
+    start = vex_get32(args);
+    out_len = 1;
+    if (strcmp(b, "/") == 0) {
+        for (uint32_t i = start; i < shared->volume_count; i++) {
+            out[out_len++] = 'D';
+            vex_put64(&out[out_len], 0);
+            out_len += 8;
+            strcpy((char *)&out[out_len], shared->volumes[i].name);
+            out_len += strlen(shared->volumes[i].name) + 1;
+        }
+        out[0] = 0;
+        return VEX_RPC_OK;
+    }
+    if (!rpc.dir.is_open() || start != rpc.dir_next || strcmp(b, rpc.dir_path) != 0) {
+        rpc.dir.close();
+        if (!is_dir(b) || (vol = resolve(b, &inner)) == NULL || !rpc.dir.open(vol->fs, inner))
+            return VEX_RPC_NOT_FOUND;
+        strcpy(rpc.dir_path, b);
+        for (rpc.dir_next = 0; rpc.dir_next < start && rpc.dir.has_entry(); rpc.dir_next++)
+            ;
+    }
+    // stop while a longest name still fits, an entry can't be put back
+    while (out_len + 10 + VOLUME_EXPLORER_FILENAME_LEN <= VEX_RPC_MAX_DATA) {
+        if (!rpc.dir.has_entry()) {
+            rpc.dir.close();
+            break;
+        }
+        FsFile &entry = rpc.dir.next_entry();
+        out[out_len++] = entry.isDir() ? 'D' : 'F';
+        vex_put64(&out[out_len], entry.isDir() ? 0 : entry.fileSize());
+        out_len += 8;
+        strcpy((char *)&out[out_len], rpc.dir.entry_name());
+        out_len += strlen(rpc.dir.entry_name()) + 1;
+        rpc.dir_next++;
+    }
+    out[0] = rpc.dir.is_open();
+    return VEX_RPC_OK;
+}
+
+// Checksums the file, or its blocks, a few chunks at a time. The task
+// buffers are free since binary mode is only entered while idle
+void VolumeExplorerSession::rpc_sum_step() {
+    uint8_t *out = &rpc.tx[VEX_RPC_HEADER_SIZE];
+    uint32_t t = micros();
+    uint64_t want;
+    int n;
+
+    do {
+        if (rpc.sum_left == 0)
+            break;
+        want = rpc.sum_left < VOLUME_EXPLORER_COPY_BUFSIZE ? rpc.sum_left : VOLUME_EXPLORER_COPY_BUFSIZE;
+        if (rpc.block_size && want > rpc.block_left)
+            want = rpc.block_left;
+        n = rpc.f.read(task.fbuf[0], want);
+        if (n < 0) {
+            rpc.summing = false;
+            rpc_reply(rpc.sum_seq, VEX_RPC_IO_ERROR, 0);
+            return;
+        }
+        if (n == 0)
+            break;
+        VEX_STAT(bytes_read, n);
+        rpc.sum_crc = vex_crc32(rpc.sum_crc, task.fbuf[0], n);
+        rpc.sum_bytes += n;
+        rpc.sum_left -= n;
+        if (rpc.block_size) {
+            rpc.sum_adler = vex_adler32(rpc.sum_adler, task.fbuf[0], n);
+            rpc.block_left -= n;
+            if (rpc.block_left == 0 || rpc.sum_left == 0)
+                rpc_block_done();
+        }
+        if (micros() - t >= task_budget_us)
+            return;
+    } while (true);
+    rpc.summing = false;
+    if (rpc.block_size) {
+        if (rpc.block_left != rpc.block_size)
+            rpc_block_done(); // the file shrank
+        rpc_reply(rpc.sum_seq, VEX_RPC_OK, rpc.out_len);
+        return;
+    }
+    vex_put32(out, rpc.sum_crc);
+    vex_put64(&out[4], rpc.sum_bytes);
+    rpc_reply(rpc.sum_seq, VEX_RPC_OK, 12);
+}
+
+// Adds the hashes of the block just read to the BLOCKS answer
+void VolumeExplorerSession::rpc_block_done() {
+    uint8_t *out = &rpc.tx[VEX_RPC_HEADER_SIZE + rpc.out_len];
+
+    vex_put32(out, rpc.sum_adler);
+    vex_put32(&out[4], rpc.sum_crc);
+    rpc.out_len += 8;
+    rpc.sum_adler = 1;
+    rpc.sum_crc = 0;
+    rpc.block_left = rpc.block_size;
+}
+
+#endif
+
@@ -0,0 +1,120 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+// Binary request / response protocol used by test rigs instead of parsing
+// the text output of the shell. Shared by the explorer and host/vex_rpc.
+//
+// Frame, both ways :
+//
+//   0xA5 | len (u16) | seq (u8) | op or status (u8) | args | crc32 (u32)
+//
+// len counts seq, op and args, the crc covers len, seq, op and args. All
+// integers are little endian, paths are absolute or relative to the
+// current directory and are zero terminated. Requests are answered in
+// order with the seq of the request, several can be sent before reading
+// the answers.
+//
+//   HELLO                                  -> version u8, max data u16
+//   LIST   start u32, path                 -> more u8, { type u8, size u64, name } ...
+//   STAT   path                            -> type u8, size u64
+//   READ   offset u64, len u16, path       -> data
+//   WRITE  offset u64, flags u8, path, data -> written u16
+//   REMOVE path                            -> -
+//   RENAME path, new_path                  -> -
+//   SUM    offset u64, len u64, path       -> crc32 u32, bytes u64
+//   BLOCKS offset u64, size u32, count u16, path -> { adler32 u32, crc32 u32 } ...
+//   QUIT                                   -> -, back to the shell
+//
+// type is 'F' or 'D', a LIST answer holds as many entries as fit and is
+// continued from start = number of entries already received while more is
+// set. SUM len 0 means up to the end of the file. BLOCKS hashes up to count
+// blocks of size bytes from offset, the last one may be short, adler32 is
+// the rolling hash a client searches its old copy of the file with (see
+// host/vex_sync). A magic byte typed at the shell prompt enters the binary
+// mode, as does the rpc command.
+
+#ifndef VOLUME_EXPLORER_RPC_H
+#define VOLUME_EXPLORER_RPC_H
+
+#include <stdint.h>
+
+#define VEX_RPC_MAGIC 0xA5
+#define VEX_RPC_VERSION 2
+#define VEX_RPC_MAX_DATA 1024
+#define VEX_RPC_MAX_PATH 256
+#define VEX_RPC_MAX_LEN (2 + 16 + 2 * VEX_RPC_MAX_PATH + VEX_RPC_MAX_DATA)
+#define VEX_RPC_HEADER_SIZE 5 // magic, len, seq, op
+#define VEX_RPC_FRAME_SIZE (VEX_RPC_MAX_LEN + 7)
+
+// WRITE flags
+#define VEX_RPC_TRUNCATE 0x01 // cut the file at offset before writing
+
+enum VexRpcOp {
+    VEX_RPC_HELLO,
+    VEX_RPC_LIST,
+    VEX_RPC_STAT,
+    VEX_RPC_READ,
+    VEX_RPC_WRITE,
+    VEX_RPC_REMOVE,
+    VEX_RPC_RENAME,
+    VEX_RPC_SUM,
+    VEX_RPC_QUIT,
+    VEX_RPC_BLOCKS
+};
+
+enum VexRpcStatus {
+    VEX_RPC_OK,
+    VEX_RPC_NOT_FOUND,
+    VEX_RPC_IO_ERROR,
+    VEX_RPC_BAD_REQUEST,
+    VEX_RPC_BAD_CRC,
+    VEX_RPC_IN_USE // open by another session
+};
+
+static inline void vex_put16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static inline void vex_put32(uint8_t *p, uint32_t v) {
+    vex_put16(p, v);
+    vex_put16(p + 2, v >> 16);
+}
+
+static inline void vex_put64(uint8_t *p, uint64_t v) {
+    vex_put32(p, v);
+    vex_put32(p + 4, v >> 32);
+}
+
+static inline uint16_t vex_get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t vex_get32(const uint8_t *p) {
+    return vex_get16(p) | ((uint32_t)vex_get16(p + 2) << 16);
+}
+
+static inline uint64_t vex_get64(const uint8_t *p) {
+    return vex_get32(p) | ((uint64_t)vex_get32(p + 4) << 32);
+}
+
+#endif
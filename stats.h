@@ -0,0 +1,109 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#ifndef VOLUME_EXPLORER_STATS_H
+#define VOLUME_EXPLORER_STATS_H
+
+#include <Arduino.h>
+
+// comment out to remove every counter from size critical builds
+#define VOLUME_EXPLORER_STATS_ENABLE
+
+#ifdef VOLUME_EXPLORER_STATS_ENABLE
+
+typedef struct {
+    uint32_t commands;
+    uint64_t time_us;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint32_t opens;
+    uint32_t dir_entries;
+    uint32_t syncs;
+    uint64_t out_bytes;
+} vex_counters_t;
+
+class VexStats {
+  public:
+    vex_counters_t current; // command being run
+    vex_counters_t last;    // previous command
+    vex_counters_t total;
+
+    VexStats() {
+        memset(this, 0, sizeof(VexStats));
+    }
+    void end_command(uint32_t time_us) {
+        current.commands = 1;
+        current.time_us = time_us;
+        last = current;
+        total.commands++;
+        total.time_us += current.time_us;
+        total.bytes_read += current.bytes_read;
+        total.bytes_written += current.bytes_written;
+        total.opens += current.opens;
+        total.dir_entries += current.dir_entries;
+        total.syncs += current.syncs;
+        total.out_bytes += current.out_bytes;
+        memset(&current, 0, sizeof(current));
+    }
+};
+
+extern VexStats *vex_stats; // the session being served
+
+#define VEX_STAT(field, n) (vex_stats->current.field += (n))
+
+// Forwards to the terminal while counting what commands print
+class VexCountingStream : public Stream {
+    Stream *s = NULL;
+
+  public:
+    void attach(Stream *_s) {
+        s = _s;
+    }
+    int available() {
+        return s->available();
+    }
+    int read() {
+        return s->read();
+    }
+    int peek() {
+        return s->peek();
+    }
+    void flush() {
+        s->flush();
+    }
+    size_t write(uint8_t c) {
+        VEX_STAT(out_bytes, 1);
+        return s->write(c);
+    }
+    size_t write(const uint8_t *buf, size_t size) {
+        VEX_STAT(out_bytes, size);
+        return s->write(buf, size);
+    }
+};
+
+#else
+
+#define VEX_STAT(field, n) ((void)0)
+
+#endif
+
+#endif
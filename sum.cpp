@@ -0,0 +1,121 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#include "volume_explorer.h"
+
+#ifdef VOLUME_EXPLORER_SUM_ENABLE
+
+static char const *sum_algos[] = {"crc32", "adler32", "sha256"};
+
+// sum [-a crc32|adler32|sha256] files... : one "hash  name" line per file,
+// as sha256sum prints them, files may be wildcard patterns
+void VolumeExplorerSession::cmd_sum(int argc, char **argv) {
+    int i = 0;
+
+    task.algo = VEX_SUM_SHA256;
+    if (strcmp(argv[0], "-a") == 0) {
+        for (task.algo = 0; argc > 2 && task.algo < 3 && stricmp(argv[1], sum_algos[task.algo]) != 0; task.algo++)
+            ;
+        if (argc <= 2 || task.algo == 3) {
+            error("sum [-a crc32|adler32|sha256] files...");
+            status = VEX_STATUS_BAD_COMMAND;
+            return;
+        }
+        i = 2;
+    }
+    keep_args(argc - i, &argv[i]);
+    task.read_us = 0;
+    task.hash_us = 0;
+    task_start(CMD_SUM);
+}
+
+void VolumeExplorerSession::sum_open() {
+    if (!check_free(task.src_file, false))
+        return;
+    if (!open_file(task.src_f, task.src_file, O_RDONLY)) {
+        error("%s not found", task.shown);
+        return;
+    }
+    if (task.src_f.isDir()) {
+        error("%s is a directory", task.shown);
+        task.src_f.close();
+        return;
+    }
+    if (task.algo == VEX_SUM_SHA256)
+        task.sha.begin();
+    else
+        task.sum = task.algo == VEX_SUM_ADLER32 ? 1 : 0;
+}
+
+// Hashes the next chunk of the current file, or moves to the next file
+bool VolumeExplorerSession::step_sum() {
+    uint8_t digest[32];
+    char sbuf[21];
+    uint32_t t = micros();
+    int n;
+
+    if (task.src_f.isOpen()) {
+        // multiples of the buffer size, so that reads stay sector aligned
+        n = task.src_f.read(task.fbuf, sizeof(task.fbuf));
+        task.read_us += micros() - t;
+        if (n > 0) {
+            VEX_STAT(bytes_read, n);
+            t = micros();
+            if (task.algo == VEX_SUM_SHA256)
+                task.sha.update(task.fbuf, n);
+            else if (task.algo == VEX_SUM_ADLER32)
+                task.sum = vex_adler32(task.sum, task.fbuf, n);
+            else
+                task.sum = vex_crc32(task.sum, task.fbuf, n);
+            task.hash_us += micros() - t;
+            task.bytes += n;
+            return true;
+        }
+        task.src_f.close();
+        if (n < 0) {
+            error("%s read error", task.shown);
+            return true;
+        }
+        if (task.algo == VEX_SUM_SHA256) {
+            task.sha.end(digest);
+            for (int i = 0; i < 32; i++)
+                term->printf("%02x", digest[i]);
+        } else
+            term->printf("%08lx", (unsigned long)task.sum);
+        term->printf("  %s\n", task.shown);
+        task.count++;
+        return true;
+    }
+    if ((n = next_arg()) > 0)
+        sum_open();
+    else if (n < 0) {
+        // to the console, the output stays a valid sha256sum -c input
+        if (task.read_us > 0 && task.hash_us > 0)
+            console->printf("%lu files %s bytes, read %lu KB/s, %s %lu KB/s\n", (unsigned long)task.count, u64toa(task.bytes, sbuf),
+                            (unsigned long)(task.bytes * 1000000 / 1024 / task.read_us), sum_algos[task.algo],
+                            (unsigned long)(task.bytes * 1000000 / 1024 / task.hash_us));
+        return false;
+    }
+    return true;
+}
+
+#endif
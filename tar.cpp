@@ -0,0 +1,417 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+#include "volume_explorer.h"
+
+// ustar field offsets
+#define TAR_NAME 0
+#define TAR_MODE 100
+#define TAR_UID 108
+#define TAR_GID 116
+#define TAR_SIZE 124
+#define TAR_MTIME 136
+#define TAR_CHKSUM 148
+#define TAR_TYPE 156
+#define TAR_MAGIC 257
+#define TAR_VERSION 263
+#define TAR_PREFIX 345
+
+static void put_octal(uint8_t *p, int len, uint64_t v) {
+    p[len - 1] = 0;
+    for (int i = len - 2; i >= 0; i--, v >>= 3)
+        p[i] = '0' + (v & 7);
+}
+
+static uint64_t get_number(uint8_t const *p, int len) {
+    uint64_t v = 0;
+
+    if (p[0] & 0x80) { // base-256
+        v = p[0] & 0x7F;
+        for (int i = 1; i < len; i++)
+            v = (v << 8) | p[i];
+        return v;
+    }
+    while (len > 0 && *p == ' ')
+        p++, len--;
+    for (int i = 0; i < len && p[i] >= '0' && p[i] <= '7'; i++)
+        v = (v << 3) | (p[i] - '0');
+    return v;
+}
+
+static uint32_t checksum(uint8_t const *h) {
+    uint32_t sum = 0;
+
+    for (int i = 0; i < VEX_TAR_BLOCK; i++)
+        sum += i >= TAR_CHKSUM && i < TAR_CHKSUM + 8 ? ' ' : h[i];
+    return sum;
+}
+
+bool vex_tar_header(uint8_t *h, char const *name, char type, uint64_t size, uint32_t mtime) {
+    size_t l = strlen(name);
+    char const *split = name;
+
+    memset(h, 0, VEX_TAR_BLOCK);
+    // the name goes in name if it fits, else cut at a '/' into prefix and name
+    if (l > 100) {
+        split = strchr(name + l - 101, '/');
+        if (!split || split - name > 155 || split[1] == 0)
+            return false;
+        memcpy(&h[TAR_PREFIX], name, split - name);
+        split++;
+    }
+    memcpy(&h[TAR_NAME], split, strlen(split));
+    put_octal(&h[TAR_MODE], 8, type == '5' ? 0755 : 0644);
+    put_octal(&h[TAR_UID], 8, 0);
+    put_octal(&h[TAR_GID], 8, 0);
+    if (size < 077777777777ULL)
+        put_octal(&h[TAR_SIZE], 12, size);
+    else {
+        h[TAR_SIZE] = 0x80;
+        for (int i = 11; i > 0; i--, size >>= 8)
+            h[TAR_SIZE + i] = size & 0xFF;
+    }
+    put_octal(&h[TAR_MTIME], 12, mtime);
+    h[TAR_TYPE] = type;
+    memcpy(&h[TAR_MAGIC], "ustar", 6);
+    memcpy(&h[TAR_VERSION], "00", 2);
+    put_octal(&h[TAR_CHKSUM], 7, checksum(h));
+    h[TAR_CHKSUM + 7] = ' ';
+    return true;
+}
+
+int vex_tar_parse(uint8_t const *h, char *name, char *type, uint64_t *size, uint32_t *mtime) {
+    size_t l = 0;
+    int i;
+
+    for (i = 0; i < VEX_TAR_BLOCK && h[i] == 0; i++)
+        ;
+    if (i == VEX_TAR_BLOCK)
+        return 0;
+    if (get_number(&h[TAR_CHKSUM], 8) != checksum(h))
+        return -1;
+    name[0] = 0;
+    if (memcmp(&h[TAR_MAGIC], "ustar", 5) == 0 && h[TAR_PREFIX]) {
+        l = strnlen((char const *)&h[TAR_PREFIX], 155);
+        memcpy(name, &h[TAR_PREFIX], l);
+        name[l++] = '/';
+    }
+    i = strnlen((char const *)&h[TAR_NAME], 100);
+    memcpy(&name[l], &h[TAR_NAME], i);
+    name[l + i] = 0;
+    *type = h[TAR_TYPE] ? h[TAR_TYPE] : '0'; // old tar
+    *size = get_number(&h[TAR_SIZE], 12);
+    *mtime = get_number(&h[TAR_MTIME], 12);
+    return 1;
+}
+
+// days since 1970-01-01 of a civil date, from H. Hinnant's algorithms
+static int32_t days_from_civil(int y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    int32_t era = y / 400;
+    unsigned yoe = y - era * 400;
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+uint32_t vex_fat_to_unix(uint16_t date, uint16_t time) {
+    int32_t days = days_from_civil(1980 + (date >> 9), (date >> 5) & 15, date & 31);
+
+    return days * 86400UL + (time >> 11) * 3600UL + ((time >> 5) & 63) * 60 + (time & 31) * 2;
+}
+
+void vex_unix_to_fat(uint32_t t, uint16_t *date, uint16_t *time) {
+    uint32_t z = t / 86400 + 719468;
+    uint32_t era = z / 146097;
+    uint32_t doe = z - era * 146097;
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    uint32_t d = doy - (153 * mp + 2) / 5 + 1;
+    uint32_t m = mp < 10 ? mp + 3 : mp - 9;
+    uint32_t y = yoe + era * 400 + (m <= 2);
+    uint32_t s = t % 86400;
+
+    if (y < 1980) {
+        *date = (1 << 5) | 1; // FAT can't go before 1980-01-01
+        *time = 0;
+        return;
+    }
+    *date = ((y - 1980) << 9) | (m << 5) | d;
+    *time = ((s / 3600) << 11) | (((s / 60) % 60) << 5) | ((s % 60) / 2);
+}
+
+#ifdef VOLUME_EXPLORER_TAR_ENABLE
+
+// tar c path [file] : the archive goes to the terminal (or its redirection)
+// or to file, member names are relative to the parent of path
+// tar x [file] : extracts into the current directory, from file or from the
+// terminal
+void VolumeExplorerSession::cmd_tar(int argc, char **argv) {
+    char const *mode = argv[0], *arg1 = argv[1], *arg2 = argv[2];
+    uint8_t *h = (uint8_t *)task.fbuf[1];
+    char name[VEX_TAR_NAME_LEN + 1];
+    uint16_t date, time;
+
+    if (strcmp(mode, "c") == 0 && arg1) {
+        expand_path(arg1, task.src_file);
+        if (strcmp(task.src_file, "/") == 0) {
+            error("can't archive /");
+            return;
+        }
+        if (!is_valid(task.src_file)) {
+            error("%s not found", arg1);
+            return;
+        }
+        if (!check_free(task.src_file, false) || (arg2 && !redirect(arg2, false)))
+            return;
+        task.base_len = strrchr(task.src_file, '/') - task.src_file + 1;
+        task.extract = false;
+        task.left = task.skip = 0;
+        if (is_dir(task.src_file)) {
+            open_file(task.tar_dirs[0], task.src_file, O_RDONLY);
+            task.tar_depth = 1;
+            task.mtime = task.tar_dirs[0].getModifyDateTime(&date, &time) ? vex_fat_to_unix(date, time) : 0;
+            snprintf(name, sizeof(name), "%s/", &task.src_file[task.base_len]);
+            vex_tar_header(h, name, '5', 0, task.mtime);
+        } else {
+            open_file(task.src_f, task.src_file, O_RDONLY);
+            task.left = task.src_f.fileSize();
+            task.skip = (VEX_TAR_BLOCK - task.left % VEX_TAR_BLOCK) % VEX_TAR_BLOCK;
+            task.mtime = task.src_f.getModifyDateTime(&date, &time) ? vex_fat_to_unix(date, time) : 0;
+            vex_tar_header(h, &task.src_file[task.base_len], '0', task.left, task.mtime);
+        }
+        term->write(h, VEX_TAR_BLOCK);
+        task_start(CMD_TAR);
+    } else if (strcmp(mode, "x") == 0 && !arg2) {
+        if (strcmp(path, "/") == 0) {
+            error("cd into a volume first");
+            return;
+        }
+        if (arg1 && !open_src(arg1))
+            return;
+        task_start(CMD_TAR);
+        task.extract = true;
+        task.raw_input = !arg1;
+        task.last_ms = millis();
+        task.left = task.skip = 0;
+        task.fill = 0;
+        task.zeros = 0;
+        if (task.raw_input)
+            console->println("ready to receive a tar stream");
+    } else {
+        error("tar c path [file] or tar x [file]");
+        status = VEX_STATUS_BAD_COMMAND;
+    }
+}
+
+// Streams one chunk of the current file, or adds the next directory entry
+bool VolumeExplorerSession::step_tar_c() {
+    uint8_t *h = (uint8_t *)task.fbuf[1];
+    char name[VEX_TAR_NAME_LEN + 1];
+    uint16_t date, time;
+    size_t l = strlen(task.src_file);
+    int n;
+
+    if (task.left > 0) {
+        n = task.src_f.read(task.fbuf[0], task.left < VOLUME_EXPLORER_COPY_BUFSIZE ? task.left : VOLUME_EXPLORER_COPY_BUFSIZE);
+        if (n <= 0) {
+            // the file shrank, pad it so that the archive stays readable
+            error("%s read error", task.src_file);
+            n = task.left < VOLUME_EXPLORER_COPY_BUFSIZE ? task.left : VOLUME_EXPLORER_COPY_BUFSIZE;
+            memset(task.fbuf[0], 0, n);
+        } else
+            VEX_STAT(bytes_read, n);
+        term->write((uint8_t *)task.fbuf[0], n);
+        task.left -= n;
+        task.bytes += n;
+        return true;
+    }
+    if (task.src_f.isOpen()) {
+        memset(h, 0, VEX_TAR_BLOCK);
+        term->write(h, task.skip);
+        task.src_f.close();
+        task.count++;
+        if (task.tar_depth == 0)
+            return step_tar_c();
+        *strrchr(task.src_file, '/') = 0;
+        return true;
+    }
+    if (task.tar_depth == 0) {
+        memset(h, 0, VEX_TAR_BLOCK);
+        term->write(h, VEX_TAR_BLOCK);
+        term->write(h, VEX_TAR_BLOCK);
+        return false;
+    }
+    if (!task.src_f.openNext(&task.tar_dirs[task.tar_depth - 1], O_RDONLY)) {
+        task.tar_dirs[--task.tar_depth].close();
+        *strrchr(task.src_file, '/') = 0;
+        return true;
+    }
+    VEX_STAT(dir_entries, 1);
+    // a name filling the buffer may have been cut, skip it rather than
+    // archive the wrong path
+    n = l + 2 < VOLUME_EXPLORER_PATH_LEN ? task.src_f.getName(&task.src_file[l + 1], VOLUME_EXPLORER_PATH_LEN - l - 1) : 0;
+    if (n == 0 || l + n + 2 >= VOLUME_EXPLORER_PATH_LEN) {
+        error("%s : entry skipped, name unreadable or too long", task.src_file);
+        task.src_f.close();
+        return true;
+    }
+    task.src_file[l] = '/';
+    task.mtime = task.src_f.getModifyDateTime(&date, &time) ? vex_fat_to_unix(date, time) : 0;
+    if (task.src_f.isDir()) {
+        snprintf(name, sizeof(name), "%s/", &task.src_file[task.base_len]);
+        if (task.tar_depth == VOLUME_EXPLORER_TAR_DEPTH || !vex_tar_header(h, name, '5', 0, task.mtime)) {
+            error("%s skipped, too deep or name too long", task.src_file);
+            task.src_f.close();
+            task.src_file[l] = 0;
+            return true;
+        }
+        task.tar_dirs[task.tar_depth++] = task.src_f;
+        task.src_f.close();
+    } else {
+        task.left = task.src_f.fileSize();
+        task.skip = (VEX_TAR_BLOCK - task.left % VEX_TAR_BLOCK) % VEX_TAR_BLOCK;
+        if (!vex_tar_header(h, &task.src_file[task.base_len], '0', task.left, task.mtime)) {
+            error("%s skipped, name too long", task.src_file);
+            task.src_f.close();
+            task.src_file[l] = 0;
+            task.left = 0;
+            return true;
+        }
+    }
+    term->write(h, VEX_TAR_BLOCK);
+    return true;
+}
+
+// Sets up the extraction of the member a header describes, false at the end
+// of the archive or on a bad header
+bool VolumeExplorerSession::tar_member(uint8_t const *h) {
+    char name[VEX_TAR_NAME_LEN + 1];
+    char const *n = name;
+    char *slash;
+    char type;
+    int r = vex_tar_parse(h, name, &type, &task.left, &task.mtime);
+
+    if (r == 0 && ++task.zeros == 2)
+        term->printf("%lu files extracted\n", (unsigned long)task.count);
+    if (r == 0)
+        return task.zeros < 2;
+    if (r < 0) {
+        error("not a tar archive");
+        return false;
+    }
+    task.zeros = 0;
+    task.skip = (VEX_TAR_BLOCK - task.left % VEX_TAR_BLOCK) % VEX_TAR_BLOCK;
+    while (*n == '/' || (n[0] == '.' && n[1] == '/'))
+        n += n[0] == '/' ? 1 : 2;
+    if (strstr(n, "..") || strlen(n) + strlen(path) + 2 > VOLUME_EXPLORER_PATH_LEN) {
+        error("%s skipped", name);
+        type = 0;
+    }
+    if (type == '5' || type == '0' || type == '7') {
+        expand_path(n, task.dst_file);
+        if (type == '5')
+            task.dst_file[strlen(task.dst_file) - 1] = 0; // trailing /
+        else if ((slash = strrchr(task.dst_file, '/')) != NULL) {
+            // parent directories, when the archive has no entry for them
+            *slash = 0;
+            if (!is_valid(task.dst_file))
+                make_dir(task.dst_file, true);
+            *slash = '/';
+        }
+    }
+    if (type == '5') {
+        if (!is_valid(task.dst_file)) {
+            if (!make_dir(task.dst_file, true))
+                error("unable to create %s", task.dst_file);
+        }
+    } else if (type == '0' || type == '7') {
+        if (check_free(task.dst_file, true) && open_file(task.dst_f, task.dst_file, O_WRITE | O_CREAT | O_TRUNC))
+            return true;
+        error("unable to write %s", task.dst_file);
+    } else if (type)
+        error("%s skipped, type %c", name, type);
+    // nothing to write, drop the data
+    task.skip += task.left;
+    task.left = 0;
+    return true;
+}
+
+bool VolumeExplorerSession::step_tar_x() {
+    uint8_t *buf = (uint8_t *)task.fbuf[0];
+    uint8_t *h = (uint8_t *)task.fbuf[1];
+    uint64_t want = task.left ? task.left : task.skip ? task.skip : VEX_TAR_BLOCK - task.fill;
+    uint8_t *dst = task.left || task.skip ? buf : &h[task.fill];
+    uint16_t date, time;
+    int n;
+
+    if (want > VOLUME_EXPLORER_COPY_BUFSIZE)
+        want = VOLUME_EXPLORER_COPY_BUFSIZE;
+    // members are closed as soon as complete, so no read is pending here
+    if (task.left == 0 && task.dst_f.isOpen()) {
+        vex_unix_to_fat(task.mtime, &date, &time);
+        task.dst_f.timestamp(T_WRITE, (date >> 9) + 1980, (date >> 5) & 15, date & 31, time >> 11, (time >> 5) & 63, (time & 31) * 2);
+        task.dst_f.close();
+        task.count++;
+        return true;
+    }
+    if (task.raw_input) {
+        // only what belongs to the archive is read, what follows stays for the shell
+        n = console->available();
+        if (n <= 0) {
+            if (millis() - task.last_ms < VOLUME_EXPLORER_TAR_TIMEOUT_MS)
+                return true;
+            error("tar stream timeout");
+            return false;
+        }
+        n = console->readBytes((char *)dst, (uint64_t)n < want ? n : want);
+        task.last_ms = millis();
+    } else {
+        n = task.src_f.read(dst, want);
+        if (n <= 0) {
+            if (task.zeros == 0)
+                error("unexpected end of archive");
+            else
+                term->printf("%lu files extracted\n", (unsigned long)task.count);
+            return false;
+        }
+        VEX_STAT(bytes_read, n);
+    }
+    if (task.left) {
+        if (task.dst_f.write(buf, n) != (size_t)n) {
+            error("%s write error", task.dst_file);
+            return false;
+        }
+        VEX_STAT(bytes_written, n);
+        task.left -= n;
+        task.bytes += n;
+    } else if (task.skip)
+        task.skip -= n;
+    else if ((task.fill += n) == VEX_TAR_BLOCK) {
+        task.fill = 0;
+        return tar_member(h);
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+
+    SdFat Volume Explorer
+
+    Copyright (C) 2019 TACTIF CIE <www.tactif.com> / Bordeaux - France
+    Author Christophe Gimenez <christophe.gimenez@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+*/
+
+// POSIX ustar format helpers for the tar command
+
+#ifndef VOLUME_EXPLORER_TAR_H
+#define VOLUME_EXPLORER_TAR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VEX_TAR_BLOCK 512
+#define VEX_TAR_NAME_LEN 256 // prefix, '/', name and a terminator
+
+// Fills a header block, false when name doesn't fit the ustar name and
+// prefix fields. Sizes from 8GB on are stored in base-256 like GNU tar does.
+bool vex_tar_header(uint8_t *h, char const *name, char type, uint64_t size, uint32_t mtime);
+
+// 1 for a member header, 0 for a zero block (end of archive), -1 when the
+// block isn't a valid header
+int vex_tar_parse(uint8_t const *h, char *name, char *type, uint64_t *size, uint32_t *mtime);
+
+// Unix time <-> FAT directory entry date and time, both in UTC
+uint32_t vex_fat_to_unix(uint16_t date, uint16_t time);
+void vex_unix_to_fat(uint32_t t, uint16_t *date, uint16_t *time);
+
+#endif
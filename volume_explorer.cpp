@@ -24,157 +24,576 @@
 #include "xmodem.h"
 #include "re.h"
 
-void VolumeExplorer::exec_command(char const *buf) {
-    char tokens[VOLUME_EXPLORER_TOKENS_BUF_SIZE];
-    char *token_ptrs[VOLUME_EXPLORER_MAX_TOKENS];
-    char *token_pos;
-    uint8_t token_count;
-    int pos = 0, prev_pos = 0, last_pos;
-
-    bzero(tokens, VOLUME_EXPLORER_TOKENS_BUF_SIZE);
-    bzero(token_ptrs, VOLUME_EXPLORER_MAX_TOKENS * sizeof(char *));
-    for (last_pos = strlen(buf); buf[last_pos] == ' '; last_pos--)
-        ;
-    token_pos = &tokens[0];
-    token_count = 0;
-    while (pos <= last_pos) {
-        if (buf[pos] == 32 || buf[pos] == 0) {
-            int l = pos - prev_pos;
-            strncpy(token_pos, &buf[prev_pos], l);
-            token_ptrs[token_count] = token_pos;
-            token_count++;
-            if (token_count == VOLUME_EXPLORER_MAX_TOKENS) {
-                term->println("Too many tokens");
-                break;
-            }
-            token_pos += l;
-            *(token_pos++) = '\0';
-            if (buf[pos] == 0)
-                break;
-            while (buf[++pos] == 32)
-                ;
-            prev_pos = pos;
-        } else
-            pos++;
+#ifdef VOLUME_EXPLORER_STATS_ENABLE
+static VexStats no_session_stats;
+VexStats *vex_stats = &no_session_stats;
+#endif
+
+constexpr VolumeExplorerSession::command_t VolumeExplorerSession::cmds[];
+
+static constexpr bool name_before(char const *a, char const *b) {
+    return *a == *b ? *a != 0 && name_before(a + 1, b + 1) : *a < *b;
+}
+
+template <typename T> static constexpr bool names_sorted(T const *t, size_t n) {
+    return n < 2 || (name_before(t[0].cmd, t[1].cmd) && names_sorted(t + 1, n - 1));
+}
+
+// Binary search of a table sorted by name, names are typed in any case
+template <typename T> static T *find_name(T *table, size_t count, char const *name) {
+    size_t lo = 0, hi = count;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int c = stricmp(name, table[mid].cmd);
+        if (c == 0)
+            return &table[mid];
+        if (c < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
     }
+    return NULL;
+}
 
-    /*
-        for (int i = 0; i < token_count; i++) {
-            term->printf("[%s]\n", token_ptrs[i]);
-        }
-    */
+VolumeExplorerSession::command_t const *VolumeExplorerSession::find_command(char const *name) {
+    static_assert(names_sorted(cmds, sizeof(cmds) / sizeof(command_t)), "cmds must be sorted by name");
+    return find_name(cmds, sizeof(cmds) / sizeof(command_t), name);
+}
 
-    command_t *cmd = NULL;
-    for (size_t i = 0; i < sizeof(cmds) / sizeof(command_t); i++) {
-        if (stricmp(cmds[i].cmd, token_ptrs[0]) == 0) {
-            cmd = &cmds[i];
-            break;
-        }
+bool VolumeExplorerSession::has_command(char const *name) {
+    return find_command(name) != NULL;
+}
+
+VolumeExplorerCommand const *VolumeExplorerSession::find_app_command(char const *name) {
+    return find_name(shared->commands, shared->command_count, name);
+}
+
+bool VolumeExplorer::add_command(char const *name, uint8_t prms, uint8_t opts, VolumeExplorerHandler run, void *ctx) {
+    VolumeExplorerCommand *c = shared.commands;
+    int i = shared.command_count;
+
+    if (i == VOLUME_EXPLORER_MAX_APP_COMMANDS || strlen(name) >= sizeof(c->cmd) || VolumeExplorerSession::has_command(name) ||
+        find_name(c, i, name))
+        return false;
+    // keeps the table sorted, lower case like the built-ins
+    for (; i > 0 && stricmp(name, c[i - 1].cmd) < 0; i--)
+        c[i] = c[i - 1];
+    for (size_t k = 0; k <= strlen(name); k++)
+        c[i].cmd[k] = tolower(name[k]);
+    c[i].prms = prms;
+    c[i].opts = opts;
+    c[i].run = run;
+    c[i].ctx = ctx;
+    shared.command_count++;
+    return true;
+}
+
+void VolumeExplorerShared::changed(VolumeExplorerVolume *vol) {
+    if (!vol)
+        return;
+    vol->free_known = vol->root_known = false;
+    vol->scan_next = 0;
+    if (vol == &volumes[scan_vol]) {
+        scan_entry.close();
+        scan_dir.close();
     }
+}
 
-    if (cmd) {
-        if (token_count - 1 != cmd->prms) {
-            error("wrong number of params");
+// One volume after the other, over as many calls as it takes : free
+// clusters from the FAT or the exFAT bitmap, then the root entries. Volumes
+// not mounted yet are left alone.
+void VolumeExplorerShared::scan() {
+    uint32_t start = micros();
+    VolumeExplorerVolume *vol = NULL;
+    uint8_t i;
+
+    for (i = 0; i < volume_count; i++, scan_vol = (scan_vol + 1) % volume_count) {
+        vol = &volumes[scan_vol];
+        if (vol->mounted && (!vol->free_known || !vol->root_known))
+            break;
+    }
+    if (i == volume_count)
+        return;
+    do {
+        if (!vol->free_known) {
+            if (vol->scan_next == 0) {
+                vol->free_clusters = 0;
+                vol->scan_next = 2;
+                if (!fat.begin(vol->fs->card())) {
+                    // no sector access, SdFat counts in one go
+                    vol->free_clusters = vol->fs->freeClusterCount();
+                    vol->cluster_count = vol->fs->clusterCount();
+                    vol->cluster_size = vol->fs->bytesPerCluster();
+                    vol->free_known = true;
+                    continue;
+                }
+                vol->cluster_count = fat.cluster_count;
+                vol->cluster_size = fat.sectors_per_cluster * VEX_SECTOR_SIZE;
+            }
+            vol->free_clusters += fat.count_free(vol->scan_next, VOLUME_EXPLORER_SCAN_CLUSTERS);
+            vol->scan_next += VOLUME_EXPLORER_SCAN_CLUSTERS;
+            vol->free_known = vol->scan_next >= fat.cluster_count + 2;
+        } else if (!scan_dir.isOpen()) {
+            vol->root_entries = 0;
+            if (!scan_dir.open(vol->fs, "/", O_READ))
+                vol->root_known = true;
+        } else if (scan_entry.openNext(&scan_dir, O_READ)) {
+            vol->root_entries++;
+            scan_entry.close();
         } else {
-            switch (cmd->id) {
-                case CMD_CD:
-                    cmd_cd(token_ptrs[1]);
-                    break;
-                case CMD_LS:
-                    cmd_ls();
-                    break;
-                case CMD_MKDIR:
-                    cmd_mkdir(token_ptrs[1]);
-                    break;
-                case CMD_RM:
-                    cmd_rm(token_ptrs[1]);
-                    break;
-                case CMD_MV:
-                    cmd_mv(token_ptrs[1], token_ptrs[2]);
-                case CMD_CP:
-                    cmd_cp(token_ptrs[1], token_ptrs[2]);
-                    break;
-                case CMD_RMDIR:
-                    cmd_rmdir(token_ptrs[1]);
-                    break;
-                case CMD_DUMP:
-                    cmd_dump(token_ptrs[1]);
-                    break;
-                case CMD_CAT:
-                    cmd_cat(token_ptrs[1]);
-                    break;
-                case CMD_TOUCH:
-                    cmd_touch(token_ptrs[1]);
-                    break;
-#ifdef VOLUME_EXPLORER_XMODEM_ENABLE
-                case CMD_RECV:
-                    cmd_recv(token_ptrs[1]);
-                    break;
-                case CMD_SEND:
-                    cmd_send(token_ptrs[1]);
-                    break;
-#endif
-#ifdef VOLUME_EXPLORER_XMODEM_ENABLE
-#ifdef VOLUME_EXPLORER_XMODEM_DEBUG
-                case CMD_DBUG:
-                    cmd_dbug();
-                    break;
+            scan_dir.close();
+            vol->root_known = true;
+        }
+    } while (!(vol->free_known && vol->root_known) && micros() - start < scan_budget_us);
+}
+
+// newlib-nano printf has no %llu, 64-bit sizes are formatted by hand
+char *u64toa(uint64_t v, char *buf) {
+    char *p = buf + 20;
+    *p = 0;
+    do {
+        *(--p) = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    return p;
+}
+
+#if VOLUME_EXPLORER_STACK_PAINT > 0
+#define VEX_STACK_PATTERN 0xC5
+
+static uintptr_t stack_low;
+
+// The stack grows down on the supported targets : the array lies below the
+// frame of the caller, the bytes overwritten later were reached by deeper calls
+void __attribute__((noinline)) vex_stack_paint() {
+    uint8_t volatile area[VOLUME_EXPLORER_STACK_PAINT];
+
+    for (size_t i = 0; i < sizeof(area); i++)
+        area[i] = VEX_STACK_PATTERN;
+    stack_low = (uintptr_t)area;
+}
+
+size_t vex_stack_peak() {
+    uint8_t volatile *p = (uint8_t volatile *)stack_low;
+    size_t i = 0;
+
+    if (!p)
+        return 0;
+    while (i < VOLUME_EXPLORER_STACK_PAINT && p[i] == VEX_STACK_PATTERN)
+        i++;
+    return VOLUME_EXPLORER_STACK_PAINT - i;
+}
+#else
+void vex_stack_paint() {
+}
+
+size_t vex_stack_peak() {
+    return 0;
+}
 #endif
+
+#if defined(VOLUME_EXPLORER_BENCH_ENABLE) || defined(VOLUME_EXPLORER_PREALLOC_ENABLE)
+// accepts k, m and g suffixes, false when s is not a size or is too large
+// for 64 bits (strtoull() saturates)
+static bool parse_size(char const *s, uint64_t *size) {
+    char *end;
+    int shift = 0;
+
+    if (!isdigit(s[0]))
+        return false;
+    *size = strtoull(s, &end, 0);
+    switch (*end) {
+        case 'g':
+        case 'G':
+            shift += 10;
+            // fallthrough
+        case 'm':
+        case 'M':
+            shift += 10;
+            // fallthrough
+        case 'k':
+        case 'K':
+            shift += 10;
+            end++;
+    }
+    if (*end || *size == UINT64_MAX || *size > UINT64_MAX >> shift)
+        return false;
+    *size <<= shift;
+    return true;
+}
 #endif
+
+enum { VEX_WORD, VEX_PIPE, VEX_REDIRECT, VEX_APPEND };
+
+static char const *vex_ops[] = {"", "|", ">", ">>"};
+
+// Splits line into words in place, words are written back over the line
+// without their quotes and escapes. "..." and '...' keep spaces, \ escapes
+// the next char (only \" and \\ within "..."), nothing within '...'.
+// Unquoted |, > and >> are words of their own, flagged in ops. Returns the
+// word count, -1 on a missing quote, -2 on too many words.
+static int tokenize(char *line, char **argv, uint8_t *ops, int max) {
+    char *r = line, *w = line;
+    char c, quote = 0;
+    bool in_word = false;
+    int n = 0;
+
+    while (true) {
+        c = *(r++);
+        if (quote) {
+            if (c == 0)
+                return -1;
+            if (c == quote)
+                quote = 0;
+            else {
+                if (c == '\\' && quote == '"' && (*r == '"' || *r == '\\'))
+                    c = *(r++);
+                *(w++) = c;
+            }
+            continue;
+        }
+        if (c == 0 || c == ' ' || c == '|' || c == '>') {
+            // w is behind r, c is already read
+            if (in_word) {
+                *(w++) = 0;
+                in_word = false;
             }
+            if (c == 0)
+                return n;
+            if (c != ' ') {
+                if (n == max)
+                    return -2;
+                ops[n] = c == '|' ? VEX_PIPE : *r == '>' ? VEX_APPEND : VEX_REDIRECT;
+                r += ops[n] == VEX_APPEND;
+                argv[n] = (char *)vex_ops[ops[n]];
+                n++;
+            }
+            continue;
+        }
+        if (!in_word) {
+            if (n == max)
+                return -2;
+            ops[n] = VEX_WORD;
+            argv[n++] = w;
+            in_word = true;
+        }
+        if (c == '"' || c == '\'')
+            quote = c;
+        else {
+            if (c == '\\' && *r != 0)
+                c = *(r++);
+            *(w++) = c;
+        }
+    }
+}
+
+void VolumeExplorerSession::exec_command(char const *buf) {
+    VexScratch scope(shared->arena);
+    char *line = (char *)shared->arena.alloc(VOLUME_EXPLORER_CMD_BUFSIZE);
+
+    if (line)
+        strlcpy(line, buf, VOLUME_EXPLORER_CMD_BUFSIZE);
+    exec_line(line);
+}
+
+// Runs a line the tokenizer may cut up in place, NULL when there was no
+// room to copy it
+void VolumeExplorerSession::exec_line(char *line) {
+    VexScratch scope(shared->arena);
+    char *argv[VOLUME_EXPLORER_MAX_TOKENS + 1];
+    uint8_t ops[VOLUME_EXPLORER_MAX_TOKENS];
+    int argc;
+
+#ifdef VOLUME_EXPLORER_STATS_ENABLE
+    vex_stats = &stats;
+#endif
+    command_start_us = micros();
+    status = VEX_STATUS_OK;
+    if (!line)
+        error("out of scratch memory");
+    else if ((argc = tokenize(line, argv, ops, VOLUME_EXPLORER_MAX_TOKENS)) < 0) {
+        error(argc == -1 ? "missing closing quote" : "too many words");
+        status = VEX_STATUS_BAD_COMMAND;
+    } else if ((argc = open_pipeline(argc, argv, ops)) > 0) {
+        // handlers find NULL after their last argument
+        for (int i = argc; i <= VOLUME_EXPLORER_MAX_TOKENS; i++)
+            argv[i] = NULL;
+        run_command(argc, argv);
+    }
+    // long commands print the prompt from task_end()
+    if (!busy())
+        command_done();
+}
+
+// Sets up "cmd | filter ... > file" : the output of cmd goes through the
+// filters to the file or the console. Returns the word count of cmd, -1 on
+// error.
+int VolumeExplorerSession::open_pipeline(int argc, char **argv, uint8_t const *ops) {
+    int cmd_end, end = argc, i;
+
+    for (cmd_end = 0; cmd_end < argc && ops[cmd_end] == VEX_WORD; cmd_end++)
+        ;
+    if (cmd_end == 0 && argc > 0) {
+        error("missing command before %s", argv[0]);
+        status = VEX_STATUS_BAD_COMMAND;
+        return -1;
+    }
+    for (i = cmd_end; i < argc && ops[i] != VEX_REDIRECT && ops[i] != VEX_APPEND; i++)
+        ;
+    if (i < argc) {
+        if (i + 2 != argc || ops[i + 1] != VEX_WORD) {
+            error(i + 1 == argc ? "missing file name after >" : "> goes last, with a single file name");
+            status = VEX_STATUS_BAD_COMMAND;
+            return -1;
         }
+        if (!redirect(argv[i + 1], ops[i] == VEX_APPEND))
+            return -1;
+        end = i;
+    }
+    // the last stage first, filters[0] writes to the output
+    while (end > cmd_end) {
+        for (i = end - 1; ops[i] != VEX_PIPE; i--)
+            ;
+        if (!open_filter(end - i - 1, &argv[i + 1]))
+            return -1;
+        end = i;
+    }
+    return cmd_end;
+}
+
+bool VolumeExplorerSession::redirect(char const *filename, bool append) {
+    if (redirect_f.isOpen()) {
+        error("output already redirected");
+        return false;
+    }
+    expand_path(filename, redirect_path);
+    if (!check_free(redirect_path, true))
+        return false;
+    if (!open_file(redirect_f, redirect_path, O_WRITE | O_CREAT | (append ? O_APPEND : O_TRUNC))) {
+        error("unable to write to %s", redirect_path);
+        return false;
+    }
+    redirect_sink.begin(&redirect_f);
+    term = &redirect_sink;
+    return true;
+}
+
+bool VolumeExplorerSession::open_filter(int argc, char **argv) {
+    bool invert = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+    if (invert) {
+        argv[1] = argc > 2 ? argv[2] : NULL;
+        argc--;
+    }
+    if (argc == 1 && stricmp(argv[0], "cat") == 0)
+        return push_filter(VEX_FILTER_CAT, NULL, false);
+    if (argc == 1 && stricmp(argv[0], "wc") == 0)
+        return push_filter(VEX_FILTER_WC, NULL, false);
+    if (argc == 2 && stricmp(argv[0], "grep") == 0)
+        return push_filter(VEX_FILTER_GREP, argv[1], invert);
+    error("can't pipe into [%s]", argc ? argv[0] : "");
+    status = VEX_STATUS_BAD_COMMAND;
+    return false;
+}
+
+// Inserts a filter between the running command and its output
+bool VolumeExplorerSession::push_filter(VexFilterMode mode, char const *pattern, bool invert) {
+    if (filter_count == VOLUME_EXPLORER_MAX_FILTERS) {
+        error("too many pipes");
+        status = VEX_STATUS_BAD_COMMAND;
+        return false;
+    }
+    filters[filter_count].begin(mode, term, pattern, invert);
+    term = &filters[filter_count++];
+    return true;
+}
+
+void VolumeExplorerSession::close_pipeline() {
+    while (filter_count > 0)
+        filters[--filter_count].end();
+    if (redirect_f.isOpen())
+        redirect_f.close();
+    term = console;
+}
+
+void VolumeExplorerSession::run_command(int argc, char **argv) {
+    command_t const *cmd = find_command(argv[0]);
+    VolumeExplorerCommand const *app = cmd ? NULL : find_app_command(argv[0]);
+
+    argc--;
+    argv++;
+    if (cmd || app) {
+        if (argc < (cmd ? cmd->prms : app->prms) || argc > (cmd ? cmd->prms + cmd->opts : app->prms + app->opts)) {
+            error("wrong number of params");
+            status = VEX_STATUS_BAD_COMMAND;
+        } else if (cmd)
+            (this->*cmd->run)(argc, argv);
+        else if (!app->run(term, argc, argv, app->ctx) && status == VEX_STATUS_OK)
+            status = VEX_STATUS_ERROR;
     } else {
-        error("unknow command [%s]", token_ptrs[0]);
+        error("unknow command [%s]", argv[-1]);
+        status = VEX_STATUS_BAD_COMMAND;
     }
-    prompt();
 }
 
-void VolumeExplorer::update() {
-    uint8_t input;
+void VolumeExplorerSession::update() {
+    VexScratch scope(shared->arena);
 
     if (stopped)
         return;
-    if (term->available() > 0) {
-        input = term->read();
+#ifdef VOLUME_EXPLORER_STATS_ENABLE
+    vex_stats = &stats;
+#endif
+#ifdef VOLUME_EXPLORER_RPC_ENABLE
+    if (rpc.active) {
+        rpc_update();
+        return;
+    }
+#endif
+    // tar x reads the archive from the terminal itself
+    if (!busy() || !task.raw_input)
+        read_input();
+    if (stopped)
+        return;
+    if (busy())
+        task_update();
+    else if (script_f.isOpen())
+        script_step();
+    else if (line_queue_len > 0)
+        exec_queued();
+}
+
+// Drains everything the terminal has into the line queue, so pasted or
+// scripted input isn't lost while a command runs
+void VolumeExplorerSession::read_input() {
+    // a full line and its two marks must fit an empty queue, or nothing is ever read again
+    static_assert(VOLUME_EXPLORER_LINE_QUEUE_SIZE >= VOLUME_EXPLORER_CMD_BUFSIZE + 2, "line queue smaller than a line");
+    uint8_t input;
+
+    while (console->available() > 0) {
+        if (line_queue_len + input_buf_index + 2 >= VOLUME_EXPLORER_LINE_QUEUE_SIZE)
+            return; // queue full, the rest waits in the stream
+        input = console->read();
+#ifdef VOLUME_EXPLORER_RPC_ENABLE
+        if (input == VEX_RPC_MAGIC && input_buf_index == 0 && idle()) {
+            rpc_begin();
+            rpc.rx[rpc.rx_len++] = input;
+            return;
+        }
+#endif
+        if (busy() && task.confirm && input >= 32) {
+            console->println();
+            task.confirm = false;
+            if (input != 'Y' && input != 'y') {
+                status = VEX_STATUS_CANCELLED;
+                task_end(VEX_TASK_CANCELLED);
+            }
+            continue;
+        }
         switch (input) {
+            case VEX_KEY_LF:
+                if (last_key == VEX_KEY_ENTER)
+                    break; // CR LF
+                // fallthrough
             case VEX_KEY_ENTER:
                 if (input_buf_index > 0) {
-                    term->println();
-                    input_buf[input_buf_index] = 0;
-                    exec_command(input_buf);
+                    if (input_echo)
+                        console->println();
+                    line_queue[line_queue_len++] = input_echo ? 'e' : 'q';
+                    memcpy(&line_queue[line_queue_len], input_buf, input_buf_index);
+                    line_queue_len += input_buf_index;
+                    line_queue[line_queue_len++] = 0;
                     input_buf_index = 0;
-                    bzero(input_buf, VOLUME_EXPLORER_CMD_BUFSIZE);
                 }
                 break;
             case VEX_KEY_DEL:
                 if (input_buf_index > 0) {
                     input_buf_index--;
-                    input_buf[input_buf_index] = 0;
 #ifdef VOLUME_EXPLORER_USE_ANSI_CODES
-                    term->print("\u001b[1D \u001b[1D"); // send ansi cursor backward
+                    if (input_echo)
+                        console->print("\u001b[1D \u001b[1D"); // send ansi cursor backward
 #endif
                 }
                 break;
+            case VEX_KEY_CTRL_C:
+                console->println("^C");
+                status = VEX_STATUS_CANCELLED;
+                line_queue_len = 0;
+                input_buf_index = 0;
+                if (script_f.isOpen()) {
+                    script_f.close();
+                    script_status = status;
+                }
+                if (busy())
+                    task_end(VEX_TASK_CANCELLED);
+                else
+                    report();
+                break;
+            case VEX_KEY_CTRL_T:
+                task_status(console);
+                break;
             case VEX_KEY_CTRL_Q:
-                term->println("bye!");
+                console->println("bye!");
                 stopped = true;
                 return;
                 break;
             default:
-                if (input >= 32 && input <= 127) {
-                    term->write(input);
+                if (input >= 32 && input <= 127 && input_buf_index < VOLUME_EXPLORER_CMD_BUFSIZE - 1) {
+                    if (input_buf_index == 0)
+                        input_echo = !batch && idle();
+                    if (input_echo)
+                        console->write(input);
                     input_buf[input_buf_index++] = input;
                 }
                 break;
         }
+        last_key = input;
     }
 }
 
-bool VolumeExplorer::file_match(char const *filename, char const *pattern) {
-    char b[256];
+void VolumeExplorerSession::exec_queued() {
+    char *line = &line_queue[1];
+    int l = strlen(line) + 2;
+
+    if (!batch && line_queue[0] != 'e')
+        console->println(line);
+    batch_line++;
+    exec_line(line);
+    memmove(line_queue, &line_queue[l], line_queue_len - l);
+    line_queue_len -= l;
+}
+
+// Runs the next line of the sourced file
+void VolumeExplorerSession::script_step() {
+    int n = script_f.fgets(script_buf, VOLUME_EXPLORER_CMD_BUFSIZE);
+
+    if (n <= 0) {
+        script_f.close();
+        status = script_status;
+        report();
+        return;
+    }
+    VEX_STAT(bytes_read, n);
+    while (n > 0 && (script_buf[n - 1] == '\n' || script_buf[n - 1] == '\r' || script_buf[n - 1] == ' '))
+        script_buf[--n] = 0;
+    if (n == 0 || script_buf[0] == '#')
+        return;
+    if (!batch) {
+        prompt();
+        console->println(script_buf);
+    }
+    exec_line(script_buf);
+}
+
+bool VolumeExplorerSession::file_match(char const *filename, char const *pattern) {
+    VexScratch scope(shared->arena);
+    char *b = scratch(256);
     int b_pos = 0, p_pos = 0;
     char c;
 
+    if (!b)
+        return false;
     while (pattern[p_pos] != 0 && b_pos < 255) {
         c = pattern[p_pos];
         switch (c) {
@@ -192,62 +611,209 @@ bool VolumeExplorer::file_match(char const *filename, char const *pattern) {
     return re_match(b, filename) == -1 ? false : true;
 }
 
-void VolumeExplorer::cmd_cd(char const *new_path) {
-    char b[VOLUME_EXPLORER_PATH_LEN];
+#if defined(VOLUME_EXPLORER_SUM_ENABLE) || defined(VOLUME_EXPLORER_FRAG_ENABLE)
+#ifdef VOLUME_EXPLORER_FRAG_ENABLE
+static bool has_suffix(char const *name, char const *suffix) {
+    size_t l = strlen(name);
+    size_t n = strlen(suffix);
+
+    return l >= n && strcmp(&name[l - n], suffix) == 0;
+}
+#endif
+
+// Keeps the file arguments of sum and frag for next_arg(), argv is gone
+// once the command has started
+void VolumeExplorerSession::keep_args(int argc, char **argv) {
+    task.args_len = 0;
+    for (int i = 0; i < argc; i++) {
+        strcpy(&task.args[task.args_len], argv[i]);
+        task.args_len += strlen(argv[i]) + 1;
+    }
+    task.args_pos = 0;
+}
+
+// Moves to the next file named by the kept arguments, patterns are matched
+// a directory entry per call. Returns 1 with task.src_file and task.shown
+// set, 0 when this call found no file, -1 once the arguments are used up.
+int VolumeExplorerSession::next_arg() {
+    char const *inner;
+    char const *arg;
+    char *slash;
+    VolumeExplorerVolume *vol;
+
+    if (task.dir.is_open()) {
+        if (!task.dir.has_entry()) {
+            task.dir.close();
+            return 0;
+        }
+        FsFile &entry = task.dir.next_entry();
+        if (entry.isDir())
+            return 0;
+        memcpy(task.src_file, task.pattern, task.base_len);
+        task.src_file[task.base_len] = '/';
+        strcpy(&task.src_file[task.base_len + 1], task.dir.entry_name());
+        if (!file_match(task.src_file, task.pattern))
+            return 0;
+#ifdef VOLUME_EXPLORER_FRAG_ENABLE
+        // the copies defrag makes as it goes, or left by a power loss
+        if (task.id == CMD_DEFRAG && (has_suffix(task.src_file, VOLUME_EXPLORER_DEFRAG_NEW) || has_suffix(task.src_file, VOLUME_EXPLORER_DEFRAG_OLD)))
+            return 0;
+#endif
+        strlcpy(&task.shown[task.shown_len], task.dir.entry_name(), VOLUME_EXPLORER_PATH_LEN - task.shown_len);
+        return 1;
+    }
+    if (task.args_pos == task.args_len)
+        return -1;
+    arg = &task.args[task.args_pos];
+    task.args_pos += strlen(arg) + 1;
+    strlcpy(task.shown, arg, VOLUME_EXPLORER_PATH_LEN);
+    if (has_wildcards(arg)) {
+        expand_path(arg, task.pattern);
+        base_path(task.pattern, task.src_file);
+        task.base_len = strlen(task.src_file);
+        slash = strrchr(task.shown, '/');
+        task.shown_len = slash ? slash - task.shown + 1 : 0;
+        vol = resolve(task.src_file, &inner);
+        if (!vol || !task.dir.open(vol->fs, inner))
+            error("dir %s not found", task.src_file);
+        return 0;
+    }
+    expand_path(arg, task.src_file);
+    return 1;
+}
+#endif
+
+void VolumeExplorerSession::cmd_cd(int argc, char **argv) {
+    char const *new_path = argv[0];
+    char *b = scratch(VOLUME_EXPLORER_PATH_LEN);
 
+    if (!b)
+        return;
     expand_path(new_path, b);
-    if (sd.exists(b)) {
+    if (is_valid(b) && is_dir(b)) {
         strcpy(path, b);
     } else
         error("%s not found", b);
 }
 
-void VolumeExplorer::cmd_ls() {
-    VolumeExplorerDir dir;
-    SdFile entry;
+static bool path_overlaps(char const *a, char const *b) {
+    size_t la = strlen(a), lb = strlen(b);
 
-    if (dir.open(path)) {
-        while (dir.has_entry()) {
-            entry = dir.next_entry();
-            if (entry.isDir()) {
-                term->printf("   D %-16s", dir.entry_name());
-            } else {
-                term->printf("   F %-16s %i", dir.entry_name(), entry.fileSize()); //, entry.size());
-            }
+    if (strncasecmp(a, b, la < lb ? la : lb) != 0)
+        return false;
+    return la == lb || (la < lb ? b[la] : a[lb]) == '/';
+}
+
+bool VolumeExplorerSession::holds(char const *pathname, bool write) {
+    if (task.src_f.isOpen() && write && path_overlaps(task.src_file, pathname))
+        return true;
+#if defined(VOLUME_EXPLORER_COMPARE_ENABLE) || defined(VOLUME_EXPLORER_MANIFEST_ENABLE)
+    if (task.cmp_f.isOpen() && write && path_overlaps(task.cmp_file, pathname))
+        return true;
+#endif
+    if (task.dst_f.isOpen() && path_overlaps(task.dst_file, pathname))
+        return true;
+    if (redirect_f.isOpen() && path_overlaps(redirect_path, pathname))
+        return true;
+#ifdef VOLUME_EXPLORER_RPC_ENABLE
+    if (rpc.f.isOpen() && (write || rpc.f_write) && path_overlaps(rpc.f_path, pathname))
+        return true;
+#endif
+    if (write && checking(pathname))
+        return true;
+    return false;
+}
+
+// fsck -r frees the clusters nobody owns, the volume must not change meanwhile
+bool VolumeExplorerSession::checking(char const *pathname) {
+#ifdef VOLUME_EXPLORER_FSCK_ENABLE
+    return task.state == VEX_TASK_RUNNING && task.id == CMD_FSCK && task.reclaim && path_overlaps(task.pattern, pathname);
+#else
+    return false;
+#endif
+}
+
+// Sessions run one at a time from update(), so nothing can change between
+// this check and the operation that follows it
+bool VolumeExplorerSession::in_use(char const *pathname, bool write) {
+    for (uint8_t i = 0; i < shared->session_count; i++)
+        if (shared->sessions[i] != this && shared->sessions[i]->holds(pathname, write))
+            return true;
+    return false;
+}
+
+// Commands that don't check in_use() first still can't write under fsck -r
+bool VolumeExplorerSession::writable(char const *pathname) {
+    for (uint8_t i = 0; i < shared->session_count; i++)
+        if (shared->sessions[i] != this && shared->sessions[i]->checking(pathname)) {
+            error("%s is being checked by fsck", pathname);
+            return false;
+        }
+    return true;
+}
+
+// Opens the file read by dump, cat, grep and wc
+bool VolumeExplorerSession::open_src(char const *filename) {
+    expand_path(filename, task.src_file);
+    if (!check_free(task.src_file, false))
+        return false;
+    if (!open_file(task.src_f, task.src_file, O_RDONLY)) {
+        error("%s not found", filename);
+        return false;
+    }
+    return true;
+}
+
+void VolumeExplorerSession::cmd_ls(int argc, char **argv) {
+    char const *inner;
+    VolumeExplorerVolume *vol = resolve(path, &inner);
+
+    if (is_root()) {
+        // counts are shown once the idle scan has them, nothing is mounted here
+        for (uint8_t i = 0; i < shared->volume_count; i++) {
+            VolumeExplorerVolume &v = shared->volumes[i];
+            term->printf("   V %-16s", v.name);
+            if (v.tried && !v.mounted)
+                term->print(" (not mounted)");
+            if (v.free_known)
+                term->printf(" %lu MB free", (unsigned long)((uint64_t)v.free_clusters * v.cluster_size >> 20));
+            if (v.root_known)
+                term->printf(" %lu entries", (unsigned long)v.root_entries);
             term->println();
         }
+    } else if (vol && task.dir.open(vol->fs, inner)) {
+        task_start(CMD_LS);
     } else
         error("dir not found");
 }
 
-void VolumeExplorer::cmd_rm(char const *pathname) {
-    char b1[VOLUME_EXPLORER_PATH_LEN];
-    char b2[VOLUME_EXPLORER_PATH_LEN];
-    VolumeExplorerDir dir;
-    SdFile entry;
+// rm pattern, or rm file [file ...]
+void VolumeExplorerSession::cmd_rm(int argc, char **argv) {
+    char *b1 = scratch(VOLUME_EXPLORER_PATH_LEN);
+    char const *inner;
+    VolumeExplorerVolume *vol = resolve(path, &inner);
 
-    expand_path(pathname, b1);
-    if (has_wildcards(pathname) && !sure())
-        return;
-    if (has_wildcards(pathname) && dir.open(path)) {
-        while (dir.has_entry()) {
-            entry = dir.next_entry();
-            if (entry.isDir())
-                continue;
-            expand_path(dir.entry_name(), b2);
-            if (file_match(b2, b1)) {
-                sd.remove(b2);
-                if (noisy)
-                    term->printf("deleted %s\n", b2);
-            }
-        }
-    } else {
-        if (!is_file(b1)) {
-            error("%s is not a file", pathname);
-            return;
-        }
-        if (sd.exists(b1)) {
-            sd.remove(b1);
+    if (!b1)
+        return;
+    if (argc == 1 && has_wildcards(argv[0])) {
+        expand_path(argv[0], b1);
+        if (vol && task.dir.open(vol->fs, inner)) {
+            strcpy(task.pattern, b1);
+            task_start(CMD_RM);
+            sure();
+        } else
+            error("dir not found");
+        return;
+    }
+    for (int i = 0; i < argc; i++) {
+        expand_path(argv[i], b1);
+        if (has_wildcards(argv[i]))
+            error("%s : a pattern goes alone", argv[i]);
+        else if (!is_file(b1))
+            error("%s is not a file", argv[i]);
+        else if (!check_free(b1, true))
+            continue;
+        else if (remove_file(b1)) {
             if (noisy)
                 term->printf("deleted %s\n", b1);
         } else
@@ -255,140 +821,229 @@ void VolumeExplorer::cmd_rm(char const *pathname) {
     }
 }
 
-void VolumeExplorer::cmd_mv(char const *pathname, char const *new_pathname) {
-    char b1[VOLUME_EXPLORER_PATH_LEN];
-    char b2[VOLUME_EXPLORER_PATH_LEN];
+void VolumeExplorerSession::cmd_mv(int argc, char **argv) {
+    char const *pathname = argv[0], *new_pathname = argv[1];
+    char *b1 = scratch(VOLUME_EXPLORER_PATH_LEN);
+    char *b2 = scratch(VOLUME_EXPLORER_PATH_LEN);
+    char const *inner1 = NULL, *inner2 = NULL;
+    VolumeExplorerVolume *vol1, *vol2;
 
+    if (!b1 || !b2)
+        return;
     expand_path(pathname, b1);
     expand_path(new_pathname, b2);
-    if (!sd.rename(b1, b2))
+    if (!check_free(b1, true) || !check_free(b2, true))
+        return;
+    vol1 = resolve(b1, &inner1);
+    vol2 = resolve(b2, &inner2);
+    if (vol1 && vol1 == vol2) {
+        if (!rename_file(b1, b2))
+            error("Unable to rename %s to %s", b1, b2);
+    } else if (vol1 && vol2 && is_file(b1)) {
+        // volumes can't rename across each other, fall back to copy & delete
+        if (copy_open(b1, b2)) {
+            task_start(CMD_CP);
+            task.move = true;
+        }
+    } else
         error("Unable to rename %s to %s", b1, b2);
 }
 
-void VolumeExplorer::cmd_cp(char const *src_filename, char const *dst_filename) {
-    char src[VOLUME_EXPLORER_PATH_LEN];
-    char dst[VOLUME_EXPLORER_PATH_LEN];
-    char base[VOLUME_EXPLORER_PATH_LEN];
-    char src_file[VOLUME_EXPLORER_PATH_LEN];
-    char dst_file[VOLUME_EXPLORER_PATH_LEN];
-    VolumeExplorerDir dir;
-    SdFile entry;
-
-    expand_path(src_filename, src);
-    expand_path(dst_filename, dst);
-    if (is_file(dst)) {
-        if (file_copy(src, dst))
-            term->printf("file %s copied to %s\n", src, dst);
+void VolumeExplorerSession::cmd_cp(int argc, char **argv) {
+    char const *src_filename = argv[0], *dst_filename = argv[1];
+    char const *inner;
+    VolumeExplorerVolume *vol;
+
+    expand_path(src_filename, task.pattern);
+    expand_path(dst_filename, task.dst);
+    if (is_file(task.dst)) {
+        if (copy_open(task.pattern, task.dst))
+            task_start(CMD_CP);
     } else {
-        base_path(src, base);
-        if (dir.open(base)) {
-            while (dir.has_entry()) {
-                entry = dir.next_entry();
-                if (entry.isDir())
-                    continue;
-                strcpy(src_file, base);
-                strcat(src_file, "/");
-                strcat(src_file, dir.entry_name());
-                if (file_match(src_file, src)) {
-                    strcpy(dst_file, dst);
-                    strcat(dst_file, "/");
-                    strcat(dst_file, dir.entry_name());
-                    if (file_copy(src_file, dst_file))
-                        term->printf("file %s copied to %s\n", src_file, dst_file);
-                }
-            }
-        } else
-            error("dir %s not found", src);
+        base_path(task.pattern, task.src_file);
+        task.base_len = strlen(task.src_file);
+        vol = resolve(task.src_file, &inner);
+        if (vol && task.dir.open(vol->fs, inner))
+            task_start(CMD_CP);
+        else
+            error("dir %s not found", task.pattern);
+    }
+}
+
+void VolumeExplorerSession::cmd_mkdir(int argc, char **argv) {
+    char *b = scratch(VOLUME_EXPLORER_PATH_LEN);
+
+    if (!b)
+        return;
+    for (int i = 0; i < argc; i++) {
+        expand_path(argv[i], b);
+        if (!make_dir(b))
+            error("unable to create dir %s", b);
     }
 }
 
-void VolumeExplorer::cmd_mkdir(char const *pathname) {
-    char b[VOLUME_EXPLORER_PATH_LEN];
+void VolumeExplorerSession::cmd_rmdir(int argc, char **argv) {
+    char *b = scratch(VOLUME_EXPLORER_PATH_LEN);
+
+    char const *inner;
+    VolumeExplorerVolume *vol;
 
-    expand_path(pathname, b);
-    if (!sd.mkdir(b))
-        error("unable to create dir %s", b);
+    if (!b)
+        return;
+    for (int i = 0; i < argc; i++) {
+        expand_path(argv[i], b);
+        vol = resolve(b, &inner);
+        if (!vol)
+            error("dir %s not found", b);
+        else if (!check_free(b, true) || !writable(b))
+            continue;
+        else if (dir_size(b) > 0)
+            error("directory %s is not empty", b);
+        else if (!vol->fs->rmdir(inner))
+            error("unable to remove dir %s", b);
+        else {
+            shared->changed(vol);
+            term->printf("dir %s deleted\n", b);
+        }
+    }
 }
 
-void VolumeExplorer::cmd_rmdir(char const *pathname) {
-    char b[VOLUME_EXPLORER_PATH_LEN];
+void VolumeExplorerSession::cmd_dump(int argc, char **argv) {
+    if (open_src(argv[0])) {
+        task_start(CMD_DUMP);
+        task.wide = task.src_f.fileSize() > 0xFFFFFFFFULL;
+    }
+}
 
-    expand_path(pathname, b);
-    if (dir_size(b) > 0)
-        error("directory is not empty");
-    else {
-        sd.rmdir(b);
-        term->printf("dir %s deleted\n", b);
+void VolumeExplorerSession::cmd_cat(int argc, char **argv) {
+    if (open_src(argv[0]))
+        task_start(CMD_CAT);
+}
+
+void VolumeExplorerSession::cmd_touch(int argc, char **argv) {
+    char *b = scratch(VOLUME_EXPLORER_PATH_LEN);
+    FsFile file;
+
+    if (!b)
+        return;
+    for (int i = 0; i < argc; i++) {
+        expand_path(argv[i], b);
+        if (!open_file(file, b, O_WRITE | O_CREAT | O_EXCL))
+            error("unable to touch file %s", argv[i]);
+        else
+            file.close();
     }
 }
 
-void VolumeExplorer::cmd_dump(char const *filename) {
-    int n, offset = 0;
-    SdFile file;
-    char b[VOLUME_EXPLORER_PATH_LEN];
-    char fbuf[8];
+#ifdef VOLUME_EXPLORER_PREALLOC_ENABLE
+// prealloc file size : a new file whose clusters are reserved in one piece
+// and erased, so that the application writes it at the speed of the card.
+// The size of the file stays 0 until it is written, truncate then gives the
+// unwritten clusters back. The file is held open while it is erased, and
+// removed when the erase fails or is cancelled.
+void VolumeExplorerSession::cmd_prealloc(int argc, char **argv) {
+    char const *filename = argv[0], *size_s = argv[1];
+    uint64_t size;
+    char const *inner;
+    VolumeExplorerVolume *vol;
+    uint32_t first, spc;
 
-    expand_path(filename, b);
-    if (file.open(b, O_RDONLY)) {
-        while ((n = file.read(fbuf, 8)) > 0) {
-            term->printf("%08X : ", offset);
-            for (int i = 0; i < n; i++) {
-                term->printf("%02X ", fbuf[i]);
-            }
-            for (int i = n; i < 8; i++)
-                term->printf("   ");
-            term->printf("  ");
-            for (int i = 0; i < n; i++) {
-                if (fbuf[i] < 32 or fbuf[i] >= 127)
-                    fbuf[i] = '.';
-                term->printf("%c", fbuf[i]);
-            }
-            term->printf("\n");
-            offset += n;
-        }
-        file.close();
-    } else {
-        error("%s not found", filename);
+    if (!parse_size(size_s, &size) || size == 0) {
+        error("bad size %s", size_s);
+        status = VEX_STATUS_BAD_COMMAND;
+        return;
+    }
+    expand_path(filename, task.dst_file);
+    if ((vol = resolve(task.dst_file, &inner)) == NULL || !open_file(task.dst_f, task.dst_file, O_WRITE | O_CREAT | O_EXCL)) {
+        error("unable to create %s", filename);
+        return;
+    }
+    if (!task.dst_f.preAllocate(size)) {
+        error("no contiguous space of %s for %s", size_s, filename);
+        task.dst_f.close();
+        remove_file(task.dst_file);
+        return;
+    }
+    first = task.dst_f.firstSector();
+    spc = vol->fs->sectorsPerCluster();
+    task.erase_card = vol->fs->card();
+    if (first == 0 || spc == 0 || !task.erase_card || task.erase_card->sectorCount() == 0) {
+        task.dst_f.close();
+        term->printf("%s : %s allocated, not erased (no sector access)\n", filename, size_s);
+        return;
     }
+    task.erase_next = first;
+    task.erase_end = first + (size + VEX_SECTOR_SIZE * spc - 1) / (VEX_SECTOR_SIZE * spc) * spc;
+    task_start(CMD_PREALLOC);
 }
 
-void VolumeExplorer::cmd_cat(char const *filename) {
-    int n;
-    SdFile file;
-    char b[VOLUME_EXPLORER_PATH_LEN];
-    char fbuf[8];
+// Erases the next chunk of the file prealloc made, chunks are aligned so
+// that the card erases whole blocks
+bool VolumeExplorerSession::step_prealloc() {
+    uint32_t end = (task.erase_next / VOLUME_EXPLORER_ERASE_SECTORS + 1) * VOLUME_EXPLORER_ERASE_SECTORS;
 
-    expand_path(filename, b);
-    if (file.open(b, O_RDONLY)) {
-        while ((n = file.fgets(fbuf, 8)) > 0) {
-            term->write(fbuf, n);
-        }
-        file.close();
-    } else {
-        error("%s not found", filename);
+    if (end > task.erase_end)
+        end = task.erase_end;
+    if (!task.erase_card->erase(task.erase_next, end - 1)) {
+        error("erase error at sector %lu", (unsigned long)task.erase_next);
+        return false;
     }
+    task.bytes += (uint64_t)(end - task.erase_next) * VEX_SECTOR_SIZE;
+    task.erase_next = end;
+    if (end < task.erase_end)
+        return true;
+    task.dst_f.close();
+    term->printf("%s : %lu KB allocated and erased\n", task.dst_file, (unsigned long)(task.bytes / 1024));
+    return false;
 }
 
-void VolumeExplorer::cmd_touch(char const *filename) {
-    char b[VOLUME_EXPLORER_PATH_LEN];
-    SdFile file;
+// truncate file [size] : without a size, gives back the clusters past the
+// end of the file, those left by prealloc for instance
+void VolumeExplorerSession::cmd_truncate(int argc, char **argv) {
+    char const *filename = argv[0], *size_s = argv[1];
+    char *b = scratch(VOLUME_EXPLORER_PATH_LEN);
+    FsFile file;
+    uint64_t size;
+    char sbuf[21];
 
+    if (!b)
+        return;
+    if (size_s && !parse_size(size_s, &size)) {
+        error("bad size %s", size_s);
+        status = VEX_STATUS_BAD_COMMAND;
+        return;
+    }
     expand_path(filename, b);
-    if (!file.open(b, O_WRITE | O_CREAT | O_EXCL))
-        error("unable to touch file %s", filename);
-    else
-        file.close();
+    if (!check_free(b, true))
+        return;
+    if (!open_file(file, b, O_RDWR) || file.isDir()) {
+        error("%s is not a file", filename);
+        return;
+    }
+    if (!size_s)
+        size = file.fileSize();
+    if (size > file.fileSize())
+        error("%s is only %s bytes", filename, u64toa(file.fileSize(), sbuf));
+    else if (!file.truncate(size))
+        error("unable to truncate %s", filename);
+    file.close();
 }
+#endif
 
 // sx -vv commands.cpp > /dev/cu.usbmodem3955991 < /dev/cu.usbmodem3955991
-void VolumeExplorer::cmd_recv(char const *filename) {
-    VexXModem xmodem(term);
-    char b[VOLUME_EXPLORER_PATH_LEN];
-    SdFile file;
+void VolumeExplorerSession::cmd_recv(int argc, char **argv) {
+    char const *filename = argv[0];
+    VexXModem xmodem(console);
+    char *b = scratch(VOLUME_EXPLORER_PATH_LEN);
+    FsFile file;
 
+    if (!b)
+        return;
     expand_path(filename, b);
-    if (file.open(b, O_WRITE | O_CREAT | O_TRUNC)) {
-        term->printf("ready to receive to file %s - disconnect from terminal and launch sx foo.txt > /dev/your_device < /dev/your_device from command line\n",
+    if (!check_free(b, true))
+        return;
+    if (open_file(file, b, O_WRITE | O_CREAT | O_TRUNC)) {
+        console->printf("ready to receive to file %s - disconnect from terminal and launch sx foo.txt > /dev/your_device < /dev/your_device from command line\n",
                      b);
         xmodem.enable_fast_write(true);
         xmodem.receive(file);
@@ -397,14 +1052,19 @@ void VolumeExplorer::cmd_recv(char const *filename) {
         error("unable to recv to %s", b);
 }
 
-void VolumeExplorer::cmd_send(char const *filename) {
-    VexXModem xmodem(term);
-    char b[VOLUME_EXPLORER_PATH_LEN];
-    SdFile file;
+void VolumeExplorerSession::cmd_send(int argc, char **argv) {
+    char const *filename = argv[0];
+    VexXModem xmodem(console);
+    char *b = scratch(VOLUME_EXPLORER_PATH_LEN);
+    FsFile file;
 
+    if (!b)
+        return;
     expand_path(filename, b);
-    if (file.open(b, O_READ)) {
-        term->printf("ready to send to file %s - disconnect from terminal and launch rx foo.txt > /dev/your_device < /dev/your_device from command line\n", b);
+    if (!check_free(b, false))
+        return;
+    if (open_file(file, b, O_READ)) {
+        console->printf("ready to send to file %s - disconnect from terminal and launch rx foo.txt > /dev/your_device < /dev/your_device from command line\n", b);
         xmodem.enable_fast_write(true);
         xmodem.send(file);
         file.close();
@@ -412,11 +1072,11 @@ void VolumeExplorer::cmd_send(char const *filename) {
         error("unable to send to %s", b);
 }
 
-void VolumeExplorer::cmd_dbug() {
+void VolumeExplorerSession::cmd_dbug(int argc, char **argv) {
     uint32_t m;
     uint8_t c;
     uint8_t v;
-    SdFile file;
+    FsFile file;
     int bcount = 0;
     int icount = 0;
     char last_flag = 'O';
@@ -436,3 +1096,525 @@ void VolumeExplorer::cmd_dbug() {
         }
     }
 }
+
+#ifdef VOLUME_EXPLORER_BENCH_ENABLE
+void VolumeExplorerSession::bench_report(char const *label, VexHistogram &h, uint64_t bytes, uint64_t us, uint32_t stalls) {
+    unsigned long kbs = us ? bytes * 1000000 / us / 1024 : 0;
+    term->printf("%-12s %8lu KB/s %6lu ops   min %lu  med %lu  p99 %lu  max %lu us", label, kbs, (unsigned long)h.samples(), (unsigned long)h.min(),
+                 (unsigned long)h.percentile(50), (unsigned long)h.percentile(99), (unsigned long)h.max());
+    if (stalls)
+        term->printf("  %lu stalls", (unsigned long)stalls);
+    term->println();
+}
+
+void VolumeExplorerSession::cmd_bench(int argc, char **argv) {
+    char const *filename = argv[0], *size_s = argv[1], *bufsize_s = argv[2];
+    char const *bad = NULL;
+    char *b = scratch(VOLUME_EXPLORER_PATH_LEN);
+    char sbuf[21];
+    FsFile file;
+    VexHistogram h;
+    uint64_t size = VOLUME_EXPLORER_BENCH_SIZE;
+    uint64_t bufsize = VOLUME_EXPLORER_BENCH_BUFSIZE;
+    uint64_t pos, total;
+    uint32_t t, dt, n, stalls;
+    uint32_t seed = 0x2545F491;
+    uint8_t *buf;
+
+    if (!b)
+        return;
+    if (size_s && !parse_size(size_s, &size))
+        bad = size_s;
+    else if (bufsize_s && !parse_size(bufsize_s, &bufsize))
+        bad = bufsize_s;
+    if (bad) {
+        error("bad size %s", bad);
+        status = VEX_STATUS_BAD_COMMAND;
+        return;
+    }
+    expand_path(filename ? filename : "bench.dat", b);
+    if (!check_free(b, true))
+        return;
+    if (bufsize < 512 || bufsize > VOLUME_EXPLORER_BENCH_MAX_BUFSIZE || size < bufsize) {
+        error("buffer size must be 512..%lu bytes and not above file size", VOLUME_EXPLORER_BENCH_MAX_BUFSIZE);
+        return;
+    }
+    // the I/O buffer of the session unless more is asked
+    buf = bufsize <= sizeof(task.fbuf) ? (uint8_t *)task.fbuf : (uint8_t *)malloc(bufsize < 4096 ? 4096 : bufsize);
+    if (!buf) {
+        error("not enough memory for a %lu bytes buffer", (unsigned long)bufsize);
+        return;
+    }
+    // the file is removed at the end, never take an existing one
+    if (!open_file(file, b, O_RDWR | O_CREAT | O_EXCL)) {
+        error("unable to create %s, bench needs a new file", b);
+        if (buf != (uint8_t *)task.fbuf)
+            free(buf);
+        return;
+    }
+    term->printf("bench %s %s bytes, %lu bytes buffer\n", b, u64toa(size, sbuf), (unsigned long)bufsize);
+    for (uint32_t i = 0; i < bufsize; i++)
+        buf[i] = i;
+
+    h.reset();
+    total = stalls = 0;
+    for (pos = 0; pos < size; pos += n) {
+        n = size - pos < bufsize ? size - pos : bufsize;
+        t = micros();
+        if (file.write(buf, n) != n) {
+            error("write failed at %s", u64toa(pos, sbuf));
+            break;
+        }
+        VEX_STAT(bytes_written, n);
+        dt = micros() - t;
+        h.add(dt);
+        total += dt;
+        stalls += dt >= VOLUME_EXPLORER_BENCH_STALL_US;
+    }
+    t = micros();
+    file.sync();
+    total += micros() - t;
+    VEX_STAT(syncs, 1);
+    size = pos;
+    bench_report("seq write", h, size, total, stalls);
+
+    h.reset();
+    total = stalls = 0;
+    file.seekSet(0);
+    for (pos = 0; pos < size; pos += n) {
+        t = micros();
+        n = file.read(buf, bufsize);
+        dt = micros() - t;
+        if (n == 0 || n > bufsize)
+            break;
+        VEX_STAT(bytes_read, n);
+        h.add(dt);
+        total += dt;
+        stalls += dt >= VOLUME_EXPLORER_BENCH_STALL_US;
+    }
+    bench_report("seq read", h, pos, total, stalls);
+
+    for (uint32_t blk = 512; blk <= 4096; blk *= 8) {
+        uint64_t blocks = size / blk;
+        if (blocks == 0)
+            break;
+        h.reset();
+        total = stalls = 0;
+        for (int i = 0; i < VOLUME_EXPLORER_BENCH_RANDOM_OPS; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            t = micros();
+            file.seekSet((seed % blocks) * blk);
+            file.read(buf, blk);
+            dt = micros() - t;
+            VEX_STAT(bytes_read, blk);
+            h.add(dt);
+            total += dt;
+            stalls += dt >= VOLUME_EXPLORER_BENCH_STALL_US;
+        }
+        bench_report(blk == 512 ? "rand 512" : "rand 4096", h, (uint64_t)blk * VOLUME_EXPLORER_BENCH_RANDOM_OPS, total, stalls);
+    }
+
+    file.close();
+    if (buf != (uint8_t *)task.fbuf)
+        free(buf);
+    remove_file(b);
+}
+#endif
+
+#ifdef VOLUME_EXPLORER_STATS_ENABLE
+void VolumeExplorerSession::cmd_stats(int argc, char **argv) {
+    vex_counters_t *c[2] = {&stats.last, &stats.total};
+    char b1[21], b2[21];
+
+    term->printf("%-10s %20s %20s\n", "", "last", "total");
+    term->printf("%-10s %20lu %20lu\n", "commands", (unsigned long)c[0]->commands, (unsigned long)c[1]->commands);
+    term->printf("%-10s %20s %20s\n", "time us", u64toa(c[0]->time_us, b1), u64toa(c[1]->time_us, b2));
+    term->printf("%-10s %20s %20s\n", "read", u64toa(c[0]->bytes_read, b1), u64toa(c[1]->bytes_read, b2));
+    term->printf("%-10s %20s %20s\n", "written", u64toa(c[0]->bytes_written, b1), u64toa(c[1]->bytes_written, b2));
+    term->printf("%-10s %20lu %20lu\n", "opens", (unsigned long)c[0]->opens, (unsigned long)c[1]->opens);
+    term->printf("%-10s %20lu %20lu\n", "entries", (unsigned long)c[0]->dir_entries, (unsigned long)c[1]->dir_entries);
+    term->printf("%-10s %20lu %20lu\n", "syncs", (unsigned long)c[0]->syncs, (unsigned long)c[1]->syncs);
+    term->printf("%-10s %20s %20s\n", "output", u64toa(c[0]->out_bytes, b1), u64toa(c[1]->out_bytes, b2));
+}
+#endif
+
+void VolumeExplorerSession::task_start(int id) {
+    task.state = VEX_TASK_RUNNING;
+    task.id = id;
+    task.confirm = false;
+    task.move = false;
+    task.raw_input = false;
+    task.count = 0;
+    task.bytes = 0;
+    task.start_ms = millis();
+}
+
+// Called from update() while a command runs, steps it until the time budget is spent
+void VolumeExplorerSession::task_update() {
+    uint32_t start = micros();
+
+    if (task.confirm)
+        return;
+    do {
+        if (!task_step()) {
+            task_end(VEX_TASK_DONE);
+            return;
+        }
+    } while (micros() - start < task_budget_us);
+}
+
+bool VolumeExplorerSession::task_step() {
+    switch (task.id) {
+        case CMD_LS:
+            return step_ls();
+        case CMD_RM:
+            return step_rm();
+        case CMD_CP:
+            return step_cp();
+        case CMD_DUMP:
+            return step_dump();
+        case CMD_CAT:
+            return step_cat();
+#ifdef VOLUME_EXPLORER_TAR_ENABLE
+        case CMD_TAR:
+            return task.extract ? step_tar_x() : step_tar_c();
+#endif
+#ifdef VOLUME_EXPLORER_IMAGE_ENABLE
+        case CMD_IMAGE:
+            return step_image();
+#endif
+#ifdef VOLUME_EXPLORER_SUM_ENABLE
+        case CMD_SUM:
+            return step_sum();
+#endif
+#ifdef VOLUME_EXPLORER_COMPARE_ENABLE
+        case CMD_CMP:
+            return step_cmp();
+        case CMD_DIFF:
+            return step_diff();
+#endif
+#ifdef VOLUME_EXPLORER_MANIFEST_ENABLE
+        case CMD_MANIFEST:
+            return step_manifest();
+#endif
+#ifdef VOLUME_EXPLORER_DF_ENABLE
+        case CMD_DF:
+            return step_df();
+#endif
+#ifdef VOLUME_EXPLORER_PREALLOC_ENABLE
+        case CMD_PREALLOC:
+            return step_prealloc();
+#endif
+#ifdef VOLUME_EXPLORER_FRAG_ENABLE
+        case CMD_FRAG:
+            return step_frag();
+        case CMD_DEFRAG:
+            return step_defrag();
+#endif
+#ifdef VOLUME_EXPLORER_FSCK_ENABLE
+        case CMD_FSCK:
+            return step_fsck();
+#endif
+    }
+    return false;
+}
+
+void VolumeExplorerSession::task_end(VolumeExplorerTaskState state) {
+    if (task.src_f.isOpen()) {
+        if (task.dst_f.isOpen())
+            task.prefetch.wait();
+        task.src_f.close();
+    }
+    if (task.dst_f.isOpen()) {
+        task.dst_f.close();
+        // don't leave a truncated copy behind
+        remove_file(task.dst_file);
+    }
+#if defined(VOLUME_EXPLORER_COMPARE_ENABLE) || defined(VOLUME_EXPLORER_MANIFEST_ENABLE)
+    task.cmp_f.close();
+#endif
+    task.dir.close();
+#if defined(VOLUME_EXPLORER_TAR_ENABLE) || defined(VOLUME_EXPLORER_MANIFEST_ENABLE)
+    while (task.tar_depth > 0)
+        task.tar_dirs[--task.tar_depth].close();
+#endif
+    task.confirm = false;
+    task.elapsed_ms = millis() - task.start_ms;
+    task.state = state;
+    command_done();
+}
+
+void VolumeExplorerSession::task_status(Stream *s) {
+    char const *name = "";
+    char sbuf[21];
+    static char const *states[] = {"idle", "running", "done", "cancelled"};
+
+    for (size_t i = 0; i < sizeof(cmds) / sizeof(command_t); i++)
+        if (cmds[i].id == task.id)
+            name = cmds[i].cmd;
+    s->printf("[%s] %s %lu entries %s bytes %lu ms\n", name, states[task.state], (unsigned long)task.count, u64toa(task.bytes, sbuf),
+                 (unsigned long)(busy() ? millis() - task.start_ms : task.elapsed_ms));
+}
+
+void VolumeExplorerSession::cmd_source(int argc, char **argv) {
+    char const *filename = argv[0];
+    char *b = scratch(VOLUME_EXPLORER_PATH_LEN);
+
+    if (!b)
+        return;
+    expand_path(filename, b);
+    if (script_f.isOpen())
+        error("already running a script");
+    else if (!open_file(script_f, b, O_RDONLY))
+        error("%s not found", b);
+    else
+        script_status = VEX_STATUS_OK;
+}
+
+void VolumeExplorerSession::cmd_batch(int argc, char **argv) {
+    if (argv[0] && stricmp(argv[0], "off") == 0) {
+        batch = false;
+    } else {
+        batch = true;
+        batch_line = 0;
+    }
+}
+
+void VolumeExplorerSession::cmd_grep(int argc, char **argv) {
+    char const *arg1 = argv[0], *arg2 = argv[1], *arg3 = argv[2];
+    bool invert = strcmp(arg1, "-v") == 0;
+    char const *pattern = invert ? arg2 : arg1;
+    char const *filename = invert ? arg3 : arg2;
+
+    if (!pattern || !filename) {
+        error("grep needs a file when not in a pipe");
+        status = VEX_STATUS_BAD_COMMAND;
+        return;
+    }
+    if (!open_src(filename))
+        return;
+    if (push_filter(VEX_FILTER_GREP, pattern, invert))
+        task_start(CMD_CAT);
+    else
+        task.src_f.close();
+}
+
+void VolumeExplorerSession::cmd_wc(int argc, char **argv) {
+    if (!open_src(argv[0]))
+        return;
+    if (push_filter(VEX_FILTER_WC, NULL, false))
+        task_start(CMD_CAT);
+    else
+        task.src_f.close();
+}
+
+// Scratch arena and stack high-water marks, the stack is counted from the
+// frame of VolumeExplorer::init() which runs at the depth of loop()
+void VolumeExplorerSession::cmd_mem(int argc, char **argv) {
+    VexArena &a = shared->arena;
+
+    term->printf("arena      %lu / %lu bytes, peak %lu, %lu failed\n", (unsigned long)a.in_use(), (unsigned long)a.capacity(), (unsigned long)a.high_water(),
+                 (unsigned long)a.failed());
+    if (VOLUME_EXPLORER_STACK_PAINT > 0)
+        term->printf("stack      peak %lu of %lu bytes watched\n", (unsigned long)vex_stack_peak(), (unsigned long)VOLUME_EXPLORER_STACK_PAINT);
+    else
+        term->println("stack      not watched");
+    term->printf("io buffer  %lu bytes per session\n", (unsigned long)sizeof(task.fbuf));
+}
+
+#ifdef VOLUME_EXPLORER_DF_ENABLE
+// Size and free space of the volumes, mounting them if need be. Free space
+// comes from the idle scan, df finishes it first when it hasn't got there.
+void VolumeExplorerSession::cmd_df(int argc, char **argv) {
+    for (uint8_t i = 0; i < shared->volume_count; i++)
+        mount(shared->volumes[i]);
+    task_start(CMD_DF);
+}
+
+bool VolumeExplorerSession::step_df() {
+    for (uint8_t i = 0; i < shared->volume_count; i++) {
+        if (shared->volumes[i].mounted && !shared->volumes[i].free_known) {
+            shared->scan();
+            return true;
+        }
+    }
+    term->println("volume      size MB    used MB    free MB  use%  cluster");
+    for (uint8_t i = 0; i < shared->volume_count; i++) {
+        VolumeExplorerVolume &v = shared->volumes[i];
+        if (!v.mounted) {
+            term->printf("%-8s  (not mounted)\n", v.name);
+            continue;
+        }
+        uint32_t size = (uint64_t)v.cluster_count * v.cluster_size >> 20;
+        uint32_t free = (uint64_t)v.free_clusters * v.cluster_size >> 20;
+        term->printf("%-8s %10lu %10lu %10lu %4lu%%  %7lu\n", v.name, (unsigned long)size, (unsigned long)(size - free), (unsigned long)free,
+                     (unsigned long)(v.cluster_count ? (uint64_t)(v.cluster_count - v.free_clusters) * 100 / v.cluster_count : 0),
+                     (unsigned long)v.cluster_size);
+    }
+    return false;
+}
+#endif
+
+void VolumeExplorerSession::cmd_jobs(int argc, char **argv) {
+    if (task.state == VEX_TASK_IDLE)
+        term->println("no job");
+    else
+        task_status(term);
+}
+
+bool VolumeExplorerSession::copy_open(char const *src_path, char const *dst_path) {
+    if (!check_free(src_path, false) || !check_free(dst_path, true))
+        return false;
+    if (!open_file(task.src_f, src_path, O_READ)) {
+        error("can't open %s for reading", src_path);
+        return false;
+    }
+    if (!open_file(task.dst_f, dst_path, O_WRITE | O_CREAT | O_EXCL)) {
+        error("can't open %s for writing", dst_path);
+        task.src_f.close();
+        return false;
+    }
+    if (src_path != task.src_file)
+        strcpy(task.src_file, src_path);
+    if (dst_path != task.dst_file)
+        strcpy(task.dst_file, dst_path);
+    // ping-pong : next chunk is read into one buffer while the other one is written
+    task.cur = 0;
+    task.prefetch.start(&task.src_f, task.fbuf[0], VOLUME_EXPLORER_COPY_BUFSIZE);
+    return true;
+}
+
+// Copies one chunk. Returns 1 while there is more to copy, 0 once the file
+// is complete and closed, -1 when a read or a write failed : both files are
+// then closed and the partial copy removed.
+int VolumeExplorerSession::copy_step() {
+    int n = task.prefetch.wait();
+
+    if (n > 0) {
+        task.cur ^= 1;
+        task.prefetch.start(&task.src_f, task.fbuf[task.cur], VOLUME_EXPLORER_COPY_BUFSIZE);
+        VEX_STAT(bytes_read, n);
+        if (task.dst_f.write(task.fbuf[task.cur ^ 1], n) == (size_t)n) {
+            task.bytes += n;
+            VEX_STAT(bytes_written, n);
+            return 1;
+        }
+        task.prefetch.wait();
+        error("%s write error", task.dst_file);
+    } else if (n < 0)
+        error("%s read error", task.src_file);
+    else if (task.dst_f.fileSize() != task.src_f.fileSize() || !task.dst_f.close())
+        error("%s is incomplete", task.dst_file);
+    else {
+        task.src_f.close();
+        task.count++;
+        return 0;
+    }
+    task.src_f.close();
+    task.dst_f.close();
+    remove_file(task.dst_file);
+    return -1;
+}
+
+bool VolumeExplorerSession::step_ls() {
+    char sbuf[21];
+
+    if (!task.dir.has_entry())
+        return false;
+    FsFile &entry = task.dir.next_entry();
+    if (entry.isDir()) {
+        term->printf("   D %-16s", task.dir.entry_name());
+    } else {
+        term->printf("   F %-16s %s", task.dir.entry_name(), u64toa(entry.fileSize(), sbuf));
+    }
+    term->println();
+    task.count++;
+    return true;
+}
+
+bool VolumeExplorerSession::step_rm() {
+    if (!task.dir.has_entry())
+        return false;
+    FsFile &entry = task.dir.next_entry();
+    if (entry.isDir())
+        return true;
+    expand_path(task.dir.entry_name(), task.src_file);
+    if (file_match(task.src_file, task.pattern) && check_free(task.src_file, true) && remove_file(task.src_file)) {
+        task.count++;
+        if (noisy)
+            term->printf("deleted %s\n", task.src_file);
+    }
+    return true;
+}
+
+// Single file copy, or wildcard copy walking the source directory one entry per step
+bool VolumeExplorerSession::step_cp() {
+    int n;
+
+    if (task.src_f.isOpen()) {
+        if ((n = copy_step()) > 0)
+            return true;
+        // the source goes only once all of it is in the copy
+        if (n == 0) {
+            term->printf("file %s copied to %s\n", task.src_file, task.dst_file);
+            if (task.move)
+                remove_file(task.src_file);
+        }
+        return task.dir.is_open();
+    }
+    if (!task.dir.has_entry())
+        return false;
+    FsFile &entry = task.dir.next_entry();
+    if (entry.isDir())
+        return true;
+    memcpy(task.src_file, task.pattern, task.base_len);
+    task.src_file[task.base_len] = '/';
+    strcpy(&task.src_file[task.base_len + 1], task.dir.entry_name());
+    if (file_match(task.src_file, task.pattern)) {
+        strcpy(task.dst_file, task.dst);
+        strcat(task.dst_file, "/");
+        strcat(task.dst_file, task.dir.entry_name());
+        copy_open(task.src_file, task.dst_file);
+    }
+    return true;
+}
+
+bool VolumeExplorerSession::step_dump() {
+    char fbuf[8];
+    int n = task.src_f.read(fbuf, 8);
+
+    if (n <= 0)
+        return false;
+    VEX_STAT(bytes_read, n);
+    if (task.wide)
+        term->printf("%04lX", (unsigned long)(task.bytes >> 32));
+    term->printf("%08lX : ", (unsigned long)(task.bytes & 0xFFFFFFFF));
+    for (int i = 0; i < n; i++) {
+        term->printf("%02X ", fbuf[i]);
+    }
+    for (int i = n; i < 8; i++)
+        term->printf("   ");
+    term->printf("  ");
+    for (int i = 0; i < n; i++) {
+        if (fbuf[i] < 32 or fbuf[i] >= 127)
+            fbuf[i] = '.';
+        term->printf("%c", fbuf[i]);
+    }
+    term->printf("\n");
+    task.bytes += n;
+    return true;
+}
+
+bool VolumeExplorerSession::step_cat() {
+    char fbuf[8];
+    int n = task.src_f.fgets(fbuf, 8);
+
+    if (n <= 0)
+        return false;
+    VEX_STAT(bytes_read, n);
+    term->write(fbuf, n);
+    task.bytes += n;
+    return true;
+}
@@ -25,98 +25,567 @@
 
 #include <Arduino.h>
 #include <SdFat.h>
+#include "histogram.h"
+#include "stats.h"
+#include "filter.h"
+#include "checksum.h"
+#include "rpc.h"
+#include "tar.h"
+#include "fat.h"
+#include "image.h"
+#include "arena.h"
+
+#ifdef VOLUME_EXPLORER_HOST
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
 
 #define VOLUME_EXPLORER_USE_ANSI_CODES
 #define VOLUME_EXPLORER_XMODEM_ENABLE
 #define VOLUME_EXPLORER_XMODEM_DEBUG
+#define VOLUME_EXPLORER_RPC_ENABLE
+
+// VOLUME_EXPLORER_SMALL, given in the build flags, fits parts with 64 KB of
+// RAM : a single session, smaller buffers and none of the commands below
+#ifndef VOLUME_EXPLORER_SMALL
+#define VOLUME_EXPLORER_BENCH_ENABLE
+#define VOLUME_EXPLORER_TAR_ENABLE
+#define VOLUME_EXPLORER_IMAGE_ENABLE
+#define VOLUME_EXPLORER_SUM_ENABLE
+#define VOLUME_EXPLORER_COMPARE_ENABLE // cmp and diff
+#define VOLUME_EXPLORER_MANIFEST_ENABLE
+#define VOLUME_EXPLORER_DF_ENABLE
+#define VOLUME_EXPLORER_PREALLOC_ENABLE // prealloc and truncate
+#define VOLUME_EXPLORER_FRAG_ENABLE
+#define VOLUME_EXPLORER_FSCK_ENABLE
+#endif
 
 #define VOLUME_EXPLORER_PATH_LEN 256
 #define VOLUME_EXPLORER_FILENAME_LEN 32
 #define VOLUME_EXPLORER_CMD_BUFSIZE 256
-#define VOLUME_EXPLORER_TOKENS_BUF_SIZE 256
-#define VOLUME_EXPLORER_MAX_TOKENS 8
+#define VOLUME_EXPLORER_MAX_TOKENS 16 // words, pipes and redirects of a line
+#define VOLUME_EXPLORER_MAX_APP_COMMANDS 8
+#define VOLUME_EXPLORER_MAX_VOLUMES 4
+#define VOLUME_EXPLORER_VOLUME_NAME_LEN 8
+#define VOLUME_EXPLORER_BENCH_SIZE (1024UL * 1024)
+#define VOLUME_EXPLORER_BENCH_BUFSIZE 4096
+#define VOLUME_EXPLORER_BENCH_MAX_BUFSIZE (64UL * 1024)
+#define VOLUME_EXPLORER_BENCH_RANDOM_OPS 256
+#define VOLUME_EXPLORER_BENCH_STALL_US 100000
+#define VOLUME_EXPLORER_TASK_BUDGET_US 500
+#define VOLUME_EXPLORER_SCAN_CLUSTERS 1024 // counted by the idle scan between two looks at the clock
+#define VOLUME_EXPLORER_FRAG_CLUSTERS 64 // chain links followed by a frag step
+#define VOLUME_EXPLORER_ERASE_SECTORS 2048 // erased by a prealloc step, a power of 2
+#define VOLUME_EXPLORER_FSCK_STEPS 256     // entries, links or clusters looked at by a fsck step
+#define VOLUME_EXPLORER_FSCK_DEPTH 16
+#define VOLUME_EXPLORER_MAX_FILTERS 3
+#define VOLUME_EXPLORER_TAR_DEPTH 8
+#define VOLUME_EXPLORER_TAR_TIMEOUT_MS 10000
+#define VOLUME_EXPLORER_IMAGE_SKIP_CLUSTERS 1024 // per skip record
+#define VOLUME_EXPLORER_DIFF_LINES 128          // window searched for the end of a change
+#define VOLUME_EXPLORER_MANIFEST ".manifest"     // sidecar caching the hashes of a directory tree
+#define VOLUME_EXPLORER_DEFRAG_NEW ".dfn"         // contiguous copy being written by defrag
+#define VOLUME_EXPLORER_DEFRAG_OLD ".dfo"         // original while the copy takes its place
+#ifdef VOLUME_EXPLORER_SMALL
+#define VOLUME_EXPLORER_MAX_SESSIONS 1
+#define VOLUME_EXPLORER_COPY_BUFSIZE 512
+#define VOLUME_EXPLORER_LINE_QUEUE_SIZE (VOLUME_EXPLORER_CMD_BUFSIZE + 2) // one full line
+#define VOLUME_EXPLORER_ARENA_SIZE 1024
+#else
+#define VOLUME_EXPLORER_MAX_SESSIONS 2
+#define VOLUME_EXPLORER_COPY_BUFSIZE 2048
+#define VOLUME_EXPLORER_LINE_QUEUE_SIZE 1024
+#define VOLUME_EXPLORER_ARENA_SIZE 2048 // scratch buffers of the command being run, shared by the sessions
+#endif
+#ifndef VOLUME_EXPLORER_STACK_PAINT
+#define VOLUME_EXPLORER_STACK_PAINT 4096        // stack watched by mem below the frame of init(), 0 for none
+#endif
+
+// newlib-nano printf has no %llu, buf holds 21 chars
+char *u64toa(uint64_t v, char *buf);
+
+// Paints the stack below the caller, vex_stack_peak() then tells how deep it
+// was used since
+void vex_stack_paint();
+size_t vex_stack_peak();
 
 class VolumeExplorerDir {
-    FatFile dir;
-    SdFile entry;
-    char buf[VOLUME_EXPLORER_PATH_LEN];
+    FsFile dir;
+    FsFile entry;
+    char buf[VOLUME_EXPLORER_FILENAME_LEN];
 
   public:
-    bool open(char const *pathname) {
-        bool b = dir.open(pathname, O_READ);
-        if (!b)
-            Serial.printf("Can't open dir %s", pathname);
+    bool open(FsVolume *fs, char const *pathname) {
+        bool b = dir.open(fs, pathname, O_READ);
+        if (b)
+            VEX_STAT(opens, 1);
         return b;
     }
     bool has_entry() {
         if (entry.isOpen())
             entry.close();
-        return entry.openNext(&dir, O_READ);
+        if (!entry.openNext(&dir, O_READ))
+            return false;
+        VEX_STAT(dir_entries, 1);
+        return true;
     }
-    SdFile &next_entry() {
+    FsFile &next_entry() {
         entry.getName(buf, VOLUME_EXPLORER_FILENAME_LEN);
         return entry;
     }
     char *entry_name() {
         return buf;
     }
-    ~VolumeExplorerDir() {
+    bool is_open() {
+        return dir.isOpen();
+    }
+    void close() {
         dir.close();
         entry.close();
     }
+    ~VolumeExplorerDir() {
+        close();
+    }
 };
 
-class VolumeExplorer {
-    Sd2Card card;
-    SdFatSdio sd;
+// Reads the next chunk of a copy while the previous one is being written.
+// Backends without an asynchronous read API complete the read in start(),
+// the host build overlaps it with a reader thread.
+class VolumeExplorerPrefetch {
+    FsFile *file;
+    int pending;
+#ifdef VOLUME_EXPLORER_HOST
+    void *buf;
+    size_t size;
+    bool requested = false, done = false, quit = false;
+    std::thread reader;
+    std::mutex lock;
+    std::condition_variable cond;
+
+    void run() {
+        std::unique_lock<std::mutex> l(lock);
+        while (true) {
+            cond.wait(l, [this] { return requested || quit; });
+            if (quit)
+                return;
+            requested = false;
+            l.unlock();
+            int n = file->read(buf, size);
+            l.lock();
+            pending = n;
+            done = true;
+            cond.notify_all();
+        }
+    }
+
+  public:
+    ~VolumeExplorerPrefetch() {
+        if (reader.joinable()) {
+            {
+                std::lock_guard<std::mutex> l(lock);
+                quit = true;
+            }
+            cond.notify_all();
+            reader.join();
+        }
+    }
+    void start(FsFile *f, void *_buf, size_t _size) {
+        if (!reader.joinable())
+            reader = std::thread(&VolumeExplorerPrefetch::run, this);
+        std::lock_guard<std::mutex> l(lock);
+        file = f;
+        buf = _buf;
+        size = _size;
+        done = false;
+        requested = true;
+        cond.notify_all();
+    }
+    int wait() {
+        std::unique_lock<std::mutex> l(lock);
+        cond.wait(l, [this] { return done; });
+        return pending;
+    }
+#else
+
+  public:
+    void start(FsFile *f, void *buf, size_t size) {
+        file = f;
+        pending = file->read(buf, size);
+    }
+    int wait() {
+        return pending;
+    }
+#endif
+};
+
+enum VolumeExplorerBackend { VEX_BACKEND_SDIO, VEX_BACKEND_SDIO_EX, VEX_BACKEND_SPI };
+
+enum VolumeExplorerSumAlgo { VEX_SUM_CRC32, VEX_SUM_ADLER32, VEX_SUM_SHA256 };
+
+enum VolumeExplorerTaskState { VEX_TASK_IDLE, VEX_TASK_RUNNING, VEX_TASK_DONE, VEX_TASK_CANCELLED };
+
+class VolumeExplorerVolume;
+
+// Directory being walked by fsck
+struct VexFsckDir {
+    uint32_t cluster; // being read, 0 for the FAT16 root
+    uint32_t left;    // clusters after it when contiguous
+    bool contiguous;  // exFAT directory without a FAT chain
+    uint16_t sector;  // in the cluster, or in the FAT16 root
+    uint8_t entry;    // next in the sector
+    uint16_t path_len;
+};
+
+// State of a long command (ls, rm *, cp, dump, cat) that update() advances
+// a few steps at a time so the host loop() keeps running
+class VolumeExplorerTask {
+  public:
+    VolumeExplorerTaskState state = VEX_TASK_IDLE;
+    int id;
+    bool confirm; // waiting for a y/n answer before starting
+    bool move;      // cp removes each source once copied (mv across volumes)
+    bool raw_input; // tar x : the terminal input is the archive, not commands
+    bool wide;
+    uint32_t count;
+    uint64_t bytes;
+    uint32_t start_ms;
+    uint32_t elapsed_ms;
+
+    VolumeExplorerDir dir;
+    char pattern[VOLUME_EXPLORER_PATH_LEN]; // expanded argument
+    int base_len;                           // directory part of pattern
+    char dst[VOLUME_EXPLORER_PATH_LEN];
+    char src_file[VOLUME_EXPLORER_PATH_LEN];
+    char dst_file[VOLUME_EXPLORER_PATH_LEN];
+
+    FsFile src_f, dst_f;
+    VolumeExplorerPrefetch prefetch;
+    char fbuf[2][VOLUME_EXPLORER_COPY_BUFSIZE]; // I/O buffer of every command, bench and rpc included
+    int cur;
+
+#if defined(VOLUME_EXPLORER_TAR_ENABLE) || defined(VOLUME_EXPLORER_MANIFEST_ENABLE)
+    // tar : directories being walked, current member
+    bool extract;
+    uint32_t last_ms;
+    FsFile tar_dirs[VOLUME_EXPLORER_TAR_DEPTH];
+    int tar_depth = 0;
+    uint64_t left; // member data
+    uint64_t skip; // padding, or a member that isn't extracted
+    int fill;      // header bytes received
+    uint8_t zeros; // end of archive blocks
+    uint32_t mtime;
+#endif
+
+#if defined(VOLUME_EXPLORER_IMAGE_ENABLE) || defined(VOLUME_EXPLORER_FRAG_ENABLE) || defined(VOLUME_EXPLORER_FSCK_ENABLE)
+    VexFat fat;
+#endif
+#ifdef VOLUME_EXPLORER_PREALLOC_ENABLE
+    // prealloc : sectors of the new file left to erase, the file stays
+    // open in dst_f meanwhile
+    SdCard *erase_card;
+    uint32_t erase_next, erase_end;
+#endif
+#ifdef VOLUME_EXPLORER_IMAGE_ENABLE
+    // image : card being read, next sector
+    SdCard *card;
+    uint32_t sector;
+    uint32_t sector_count;
+    uint32_t skipped, bad;
+#endif
+
+#if defined(VOLUME_EXPLORER_SUM_ENABLE) || defined(VOLUME_EXPLORER_MANIFEST_ENABLE) || defined(VOLUME_EXPLORER_FRAG_ENABLE)
+    // sum and frag : patterns left, hash of the current file
+    char args[VOLUME_EXPLORER_CMD_BUFSIZE];
+    int args_pos, args_len;
+    char shown[VOLUME_EXPLORER_PATH_LEN]; // file name as typed, printed with its hash
+    int shown_len;                        // directory part of a pattern as typed
+    uint8_t algo;
+    uint32_t sum;
+    VexSha256 sha;
+    uint32_t read_us, hash_us;
+#endif
+
+#if defined(VOLUME_EXPLORER_COMPARE_ENABLE) || defined(VOLUME_EXPLORER_MANIFEST_ENABLE)
+    // cmp and diff : src_f against cmp_f, diff reads lines through fbuf
+    FsFile cmp_f;
+    char cmp_file[VOLUME_EXPLORER_PATH_LEN];
+#endif
+#ifdef VOLUME_EXPLORER_COMPARE_ENABLE
+    bool count_all; // cmp -c
+    uint64_t diffs;
+    uint32_t lines[2]; // before the windows
+    uint32_t line_off[2];
+    int line_pos[2], line_len[2];
+    uint32_t diff_hash[2][VOLUME_EXPLORER_DIFF_LINES];
+    uint32_t diff_off[2][VOLUME_EXPLORER_DIFF_LINES + 1];
+#endif
+
+#ifdef VOLUME_EXPLORER_MANIFEST_ENABLE
+    // manifest : walks tar_dirs, old sidecar in cmp_f, new one in dst_f
+    uint32_t hashed;
+#endif
+
+#ifdef VOLUME_EXPLORER_FRAG_ENABLE
+    // frag and defrag : cluster chain of the current file, free space of
+    // free_vol, defrag then copies the file to a contiguous one
+    uint8_t phase;
+    bool dry_run; // defrag -n
+    VolumeExplorerVolume *vol;
+    uint32_t cluster; // next to follow
+    uint32_t clusters, chain_left;
+    uint32_t run, largest, extents;
+    uint32_t fragmented, all_extents, extents_after;
+    VolumeExplorerVolume *free_vol;
+    uint32_t free_cluster;
+    uint32_t free_run, free_largest, free_extents, free_total;
+    uint16_t date, time;
+#endif
+
+#ifdef VOLUME_EXPLORER_FSCK_ENABLE
+    // fsck : fbuf has a bit per cluster of the window, set once a file or a
+    // directory owns it. src_file is the path being walked, dst_file the
+    // name of the entry.
+    VolumeExplorerVolume *fsck_vol;
+    uint8_t fsck_phase;
+    bool reclaim;  // fsck -r
+    bool partial;  // an unreadable, broken or cross-linked chain, owners may be missing : -r frees nothing
+    uint32_t window, window_end;
+    VexFsckDir fsck_dirs[VOLUME_EXPLORER_FSCK_DEPTH];
+    int fsck_depth;
+    uint8_t dir_buf[VEX_SECTOR_SIZE];
+    uint32_t dir_sector;
+    uint8_t lfn;      // FAT : sequence of the last long name entry
+    uint8_t set_left; // exFAT : secondary entries of the file
+    int name_len;
+    // entry found, chain being followed
+    bool entry_dir, entry_contiguous;
+    uint32_t entry_first;
+    uint64_t entry_size;
+    uint16_t entry_path_len;
+    uint32_t link, links;
+    bool crossed;
+    uint32_t lost_start, lost_end; // run being gathered
+    uint32_t unreadable_end;       // past the last cluster the lost scan couldn't read
+    uint32_t files, dirs, lost, lost_runs, cross, mismatched, broken, reclaimed;
+#endif
+};
+
+// Binary mode state, see rpc.h
+class VolumeExplorerRpc {
+  public:
+    bool active = false;
+    uint8_t rx[VEX_RPC_FRAME_SIZE];
+    uint16_t rx_len = 0;
+    uint8_t tx[VEX_RPC_FRAME_SIZE];
+
+    // last file read or written, kept open for the next range
+    FsFile f;
+    char f_path[VOLUME_EXPLORER_PATH_LEN];
+    bool f_write;
+
+    // last directory listed, continued when start follows
+    VolumeExplorerDir dir;
+    char dir_path[VOLUME_EXPLORER_PATH_LEN];
+    uint32_t dir_next;
+
+    // SUM and BLOCKS run over several update() calls, input waits meanwhile
+    bool summing = false;
+    uint8_t sum_seq;
+    uint32_t sum_crc;
+    uint64_t sum_left, sum_bytes;
+    uint32_t block_size; // 0 for SUM
+    uint32_t block_left;
+    uint32_t sum_adler;
+    uint16_t out_len;
+};
+
+// Mount table entry given at construction, volume "sd1" is reachable as /sd1
+struct VolumeExplorerMount {
+    char const *name;
+    VolumeExplorerBackend backend;
+    uint8_t cs_pin; // SPI backend only
+};
+
+class VolumeExplorerVolume {
+  public:
+    char name[VOLUME_EXPLORER_VOLUME_NAME_LEN];
+    VolumeExplorerBackend backend;
+    uint8_t cs_pin;
+    SdFs *fs = NULL; // FAT16/32 or exFAT, depending on how the card is formatted
+    bool mounted = false;
+    bool tried = false; // begin() was called, mounted tells how it went
+
+    // gathered by VolumeExplorerShared::scan() while the sessions are idle,
+    // until changed() drops them
+    bool free_known = false;
+    uint32_t free_clusters;
+    uint32_t cluster_size; // bytes
+    uint32_t cluster_count;
+    uint32_t scan_next = 0; // next cluster to count, 0 before the first
+    bool root_known = false;
+    uint32_t root_entries;
+
+    bool begin() {
+        tried = true;
+        if (!fs)
+            fs = new SdFs();
+        switch (backend) {
+#if HAS_SDIO_CLASS
+            case VEX_BACKEND_SDIO:
+                mounted = fs->begin(SdioConfig(DMA_SDIO));
+                break;
+            case VEX_BACKEND_SDIO_EX:
+                mounted = fs->begin(SdioConfig(FIFO_SDIO));
+                break;
+#endif
+            case VEX_BACKEND_SPI:
+                mounted = fs->begin(SdSpiConfig(cs_pin, SHARED_SPI, SD_SCK_MHZ(50)));
+                break;
+            default:
+                mounted = false;
+                break;
+        }
+        return mounted;
+    }
+};
+
+class VolumeExplorerSession;
+
+// Command added by the application with VolumeExplorer::add_command() : out
+// is the terminal or where the command line redirects it, argv holds the
+// arguments after the name, returning false marks the command failed
+typedef bool (*VolumeExplorerHandler)(Stream *out, int argc, char **argv, void *ctx);
+
+struct VolumeExplorerCommand {
+    char cmd[12];
+    uint8_t prms;
+    uint8_t opts; // optional params after the mandatory ones
+    VolumeExplorerHandler run;
+    void *ctx;
+};
+
+// What the sessions have in common
+class VolumeExplorerShared {
+  public:
+    VolumeExplorerVolume volumes[VOLUME_EXPLORER_MAX_VOLUMES];
+    uint8_t volume_count = 0;
+    VolumeExplorerSession *sessions[VOLUME_EXPLORER_MAX_SESSIONS];
+    uint8_t session_count = 0;
+    VolumeExplorerCommand commands[VOLUME_EXPLORER_MAX_APP_COMMANDS]; // sorted by name
+    uint8_t command_count = 0;
+    // sessions run one at a time and release their scratch before returning
+    VexStaticArena<VOLUME_EXPLORER_ARENA_SIZE> arena;
+
+    // volumes are mounted by the first command using them, sessions start
+    // on a bare prompt
+    bool lazy = false;
+    uint32_t scan_budget_us = VOLUME_EXPLORER_TASK_BUDGET_US;
+    uint8_t scan_vol = 0; // the one scan() works on
+    VexFat fat;
+    FsFile scan_dir, scan_entry;
+
+    // mounts vol on first use, false when it can't be
+    bool mount(VolumeExplorerVolume *vol) {
+        if (!vol->tried && vol->begin() && vol == &volumes[0])
+            vol->fs->chvol(); // files opened without a volume (xmodem log) go to the first one
+        return vol->mounted;
+    }
+    // something was written to vol, its counts are redone
+    void changed(VolumeExplorerVolume *vol);
+    // counts free clusters and root entries a slice at a time
+    void scan();
+};
+
+// A shell on one Stream : current directory, input, running command
+class VolumeExplorerSession {
+    friend class VolumeExplorerBench; // host/bench.cpp times private helpers
+
+    VolumeExplorerShared *shared;
 
     char path[VOLUME_EXPLORER_PATH_LEN] = {0};
-    Stream *term;
+    Stream *console; // prompt, errors and input
+    Stream *term;    // command output, the console unless redirected or piped
+#ifdef VOLUME_EXPLORER_STATS_ENABLE
+    VexCountingStream term_counter;
+    VexStats stats;
+#endif
+
+    // pipeline, filters[0] is the last stage
+    VexFilter filters[VOLUME_EXPLORER_MAX_FILTERS];
+    uint8_t filter_count = 0;
+    FsFile redirect_f;
+    char redirect_path[VOLUME_EXPLORER_PATH_LEN];
+    VexFileSink redirect_sink;
 
     char input_buf[VOLUME_EXPLORER_CMD_BUFSIZE] = {0};
     int input_buf_index;
+    bool input_echo; // decided on the first char : only lines typed at the prompt are echoed
+    uint8_t last_key;
+
+    // complete lines waiting for the running command, stored as echo flag, text, 0
+    char line_queue[VOLUME_EXPLORER_LINE_QUEUE_SIZE];
+    int line_queue_len = 0;
+
+    bool batch = false; // no echo nor prompt, a status line per command
+    uint32_t batch_line;
+    int status; // VEX_STATUS_xxx of the command being run
+
+    FsFile script_f; // source file
+    char script_buf[VOLUME_EXPLORER_CMD_BUFSIZE];
+    int script_status;
 
     bool noisy = true;
     bool stopped = false;
 
-    enum { VEX_KEY_ENTER = 13, VEX_KEY_DEL = 127, VEX_KEY_CTRL_Q = 17 };
+    VolumeExplorerTask task;
+#ifdef VOLUME_EXPLORER_RPC_ENABLE
+    VolumeExplorerRpc rpc;
+#endif
+    uint32_t task_budget_us = VOLUME_EXPLORER_TASK_BUDGET_US;
+    uint32_t command_start_us;
+
+    enum { VEX_KEY_CTRL_C = 3, VEX_KEY_LF = 10, VEX_KEY_ENTER = 13, VEX_KEY_CTRL_Q = 17, VEX_KEY_CTRL_T = 20, VEX_KEY_DEL = 127 };
+    enum { VEX_STATUS_OK, VEX_STATUS_ERROR, VEX_STATUS_BAD_COMMAND, VEX_STATUS_CANCELLED };
+
+    // handlers get the arguments after the name, argv[argc] and up are NULL
+    typedef void (VolumeExplorerSession::*handler_t)(int argc, char **argv);
 
     typedef struct {
-        int id;
-        char cmd[6];
+        int id; // of the task it starts, names it in jobs
+        char cmd[12];
         uint8_t prms;
+        uint8_t opts; // optional params after the mandatory ones
+        handler_t run;
     } command_t;
 
-    enum cmd_id { CMD_LS, CMD_CD, CMD_MKDIR, CMD_RM, CMD_MV, CMD_CP, CMD_RMDIR, CMD_DUMP, CMD_CAT, CMD_TOUCH, CMD_RECV, CMD_SEND, CMD_DBUG };
-
-    command_t cmds[13] = {
-        {.id = CMD_LS, .cmd = "ls", .prms = 0},
-        {.id = CMD_CD, .cmd = "cd", .prms = 1},
-        {.id = CMD_RM, .cmd = "rm", .prms = 1},
-        {.id = CMD_MV, .cmd = "mv", .prms = 2},
-        {.id = CMD_CP, .cmd = "cp", .prms = 2},
-        {.id = CMD_MKDIR, .cmd = "mkdir", .prms = 1},
-        {.id = CMD_RMDIR, .cmd = "rmdir", .prms = 1},
-        {.id = CMD_DUMP, .cmd = "dump", .prms = 1},
-        {.id = CMD_CAT, .cmd = "cat", .prms = 1},
-        {.id = CMD_TOUCH, .cmd = "touch", .prms = 1},
-        {.id = CMD_RECV, .cmd = "recv", .prms = 1},
-        {.id = CMD_SEND, .cmd = "send", .prms = 1},
-        {.id = CMD_DBUG, .cmd = "dbug", .prms = 0}, // Internal use for xmodem debugging
-    };
+    enum cmd_id { CMD_LS, CMD_CD, CMD_MKDIR, CMD_RM, CMD_MV, CMD_CP, CMD_RMDIR, CMD_DUMP, CMD_CAT, CMD_TOUCH, CMD_RECV, CMD_SEND, CMD_DBUG, CMD_BENCH, CMD_STATS, CMD_JOBS, CMD_SOURCE, CMD_BATCH, CMD_GREP, CMD_WC, CMD_RPC, CMD_TAR, CMD_IMAGE, CMD_SUM, CMD_CMP, CMD_DIFF, CMD_MANIFEST, CMD_MEM, CMD_DF, CMD_FRAG, CMD_DEFRAG, CMD_PREALLOC, CMD_TRUNCATE, CMD_FSCK };
 
   private:
     void prompt() {
-        term->printf("#%s:", path);
+        console->printf("#%s:", path);
     }
 
     void error(const char *format, ...) {
-        char sbuf[256];
+        VexScratch scope(shared->arena);
+        char *sbuf = (char *)shared->arena.alloc(256);
         va_list args;
-        va_start(args, format);
-        vsnprintf(sbuf, 256, format, args);
-        va_end(args);
-        term->printf("error : %s\n", sbuf);
+        if (sbuf) {
+            va_start(args, format);
+            vsnprintf(sbuf, 256, format, args);
+            va_end(args);
+        }
+        console->printf("error : %s\n", sbuf ? sbuf : format);
+        if (status == VEX_STATUS_OK)
+            status = VEX_STATUS_ERROR;
+    }
+
+    // from the arena, until the VexScratch of update() or exec_line() ends
+    char *scratch(size_t size) {
+        char *p = (char *)shared->arena.alloc(size);
+        if (!p)
+            error("out of scratch memory");
+        return p;
     }
 
     void base_path(char const *pathname, char *base) {
@@ -127,19 +596,20 @@ class VolumeExplorer {
         base[i] = 0;
     }
 
+    // base holds VOLUME_EXPLORER_PATH_LEN chars, the path is joined in it
+    // then .. are removed in place
     void expand_path(char const *pathname, char *base) {
-        char tmp[VOLUME_EXPLORER_PATH_LEN];
         char *b_pos, *t_pos;
 
         if (is_absolute(pathname)) {
-            strcpy(tmp, pathname);
+            strlcpy(base, pathname, VOLUME_EXPLORER_PATH_LEN);
         } else {
-            strcpy(tmp, path);
+            strlcpy(base, path, VOLUME_EXPLORER_PATH_LEN);
             if (strlen(path) > 1)
-                strcat(tmp, "/");
-            strcat(tmp, pathname);
+                strlcat(base, "/", VOLUME_EXPLORER_PATH_LEN);
+            strlcat(base, pathname, VOLUME_EXPLORER_PATH_LEN);
         }
-        t_pos = tmp;
+        t_pos = base;
         b_pos = base;
         while (*(t_pos) != '\0') {
             uint16_t ddot = *(uint16_t *)(t_pos);
@@ -167,40 +637,98 @@ class VolumeExplorer {
         return false;
     }
 
-    bool file_copy(char const *src_path, char const *dst_path) {
-        File src, dst;
-        char fbuf[4096];
-        int n;
+    // Splits an expanded path into its volume and the path inside that volume
+    VolumeExplorerVolume *resolve(char const *pathname, char const **inner) {
+        char const *name = pathname + 1;
+        size_t l = strcspn(name, "/");
 
-        if (!src.open(src_path, O_READ)) {
-            error("can't open %s for reading", src_path);
-            return false;
+        for (uint8_t i = 0; i < shared->volume_count; i++) {
+            VolumeExplorerVolume &vol = shared->volumes[i];
+            if (strlen(vol.name) == l && strncmp(vol.name, name, l) == 0) {
+                if (!mount(vol))
+                    return NULL;
+                *inner = name[l] != 0 ? &name[l] : "/";
+                return &vol;
+            }
         }
-        if (!dst.open(dst_path, O_WRITE | O_CREAT | O_EXCL)) {
-            error("can't open %s for writing", dst_path);
+        return NULL;
+    }
+
+    bool mount(VolumeExplorerVolume &vol) {
+        bool tried = vol.tried;
+        if (!shared->mount(&vol) && !tried)
+            console->printf("%s begin error\n", vol.name);
+        return vol.mounted;
+    }
+
+    bool open_file(FsFile &f, char const *pathname, oflag_t oflag) {
+        char const *inner;
+        VolumeExplorerVolume *vol = resolve(pathname, &inner);
+        if (!vol || ((oflag & (O_WRITE | O_RDWR)) && !writable(pathname)) || !f.open(vol->fs, inner, oflag))
             return false;
-        }
-        while ((n = src.read(fbuf, 4096)) > 0) {
-            dst.write(fbuf, n);
-        }
-        src.close();
-        dst.close();
+        VEX_STAT(opens, 1);
+        if (oflag & (O_WRITE | O_RDWR))
+            shared->changed(vol);
+        return true;
+    }
+
+    // another session has the file, or a file inside it, open
+    bool in_use(char const *pathname, bool write);
+    // every write goes through it, false while another session runs fsck -r on the volume
+    bool writable(char const *pathname);
+    bool check_free(char const *pathname, bool write) {
+        if (!in_use(pathname, write))
+            return true;
+        error("%s is in use", pathname);
+        return false;
+    }
+    bool open_src(char const *filename);
+
+    bool remove_file(char const *pathname) {
+        char const *inner;
+        VolumeExplorerVolume *vol = resolve(pathname, &inner);
+        if (!vol || !writable(pathname) || !vol->fs->remove(inner))
+            return false;
+        shared->changed(vol);
+        return true;
+    }
+
+    bool make_dir(char const *pathname, bool parents = false) {
+        char const *inner;
+        VolumeExplorerVolume *vol = resolve(pathname, &inner);
+        if (!vol || !writable(pathname) || !vol->fs->mkdir(inner, parents))
+            return false;
+        shared->changed(vol);
+        return true;
+    }
+
+    // same volume only
+    bool rename_file(char const *pathname, char const *new_pathname) {
+        char const *inner1, *inner2;
+        VolumeExplorerVolume *vol = resolve(pathname, &inner1);
+        if (!vol || vol != resolve(new_pathname, &inner2) || !writable(pathname) || !vol->fs->rename(inner1, inner2))
+            return false;
+        shared->changed(vol); // the root may have lost or gained an entry
         return true;
     }
 
     bool is_valid(char const *pathname) {
-        File f;
+        FsFile f;
         bool r;
-        f.open(pathname, O_READ);
+        if (strcmp(pathname, "/") == 0)
+            return true;
+        open_file(f, pathname, O_READ);
         r = f;
         f.close();
         return r;
     }
 
     bool is_dir(char const *pathname) {
-        File f;
+        FsFile f;
         bool r;
-        f.open(pathname, O_READ);
+        if (strcmp(pathname, "/") == 0)
+            return true;
+        open_file(f, pathname, O_READ);
         r = f.isDir();
         f.close();
         return r;
@@ -223,11 +751,15 @@ class VolumeExplorer {
     }
 
     int dir_size(char const *pathname) {
-        SdFile entry;
-        FatFile dir;
+        FsFile entry;
+        FsFile dir;
         int count = 0;
-        if (dir.open(pathname, O_READ)) {
+        char const *inner;
+        VolumeExplorerVolume *vol = resolve(pathname, &inner);
+        if (vol && dir.open(vol->fs, inner, O_READ)) {
+            VEX_STAT(opens, 1);
             while (entry.openNext(&dir, O_READ)) {
+                VEX_STAT(dir_entries, 1);
                 count++;
                 entry.close();
             }
@@ -237,44 +769,369 @@ class VolumeExplorer {
         return count;
     }
 
-    bool sure() {
-        term->print("are you sure ? [Yy/Nn] :");
-        while (term->available() == 0)
-            ;
-        int r = term->read();
-        term->println();
-        return r == 'Y' || r == 'y';
+    void bench_report(char const *label, VexHistogram &h, uint64_t bytes, uint64_t us, uint32_t stalls);
+
+    // the answer is read by task_update(), the task starts once confirmed
+    void sure() {
+        console->print("are you sure ? [Yy/Nn] :");
+        task.confirm = true;
+    }
+
+    void command_done() {
+        close_pipeline();
+#ifdef VOLUME_EXPLORER_STATS_ENABLE
+        stats.end_command(micros() - command_start_us);
+#endif
+        if (script_f.isOpen()) {
+            if (status > script_status)
+                script_status = status;
+            return;
+        }
+        report();
     }
 
+    // prompt, or status line in batch mode
+    void report() {
+        if (batch)
+            console->printf("@%lu %d\n", (unsigned long)batch_line, status);
+        else
+            prompt();
+    }
+
+    static command_t const *find_command(char const *name);
+    VolumeExplorerCommand const *find_app_command(char const *name);
+    void exec_line(char *line);
+    void run_command(int argc, char **argv);
+    int open_pipeline(int argc, char **argv, uint8_t const *ops);
+    bool redirect(char const *filename, bool append);
+    bool open_filter(int argc, char **argv);
+    bool push_filter(VexFilterMode mode, char const *pattern, bool invert);
+    void close_pipeline();
+    void read_input();
+    void exec_queued();
+    void script_step();
+
+    void task_start(int id);
+    void task_update();
+    bool task_step();
+    void task_end(VolumeExplorerTaskState state);
+    void task_status(Stream *s);
+    void rpc_begin();
+    void rpc_end();
+    void rpc_update();
+    void rpc_frame();
+    void rpc_reply(uint8_t seq, uint8_t status, uint16_t len);
+    bool rpc_path(uint8_t const *args, uint16_t len, uint16_t &pos, char *b);
+    uint8_t rpc_file(char const *pathname, bool write);
+    uint8_t rpc_list(uint8_t const *args, uint16_t len, uint16_t &out_len);
+    void rpc_sum_step();
+    void rpc_block_done();
+    bool copy_open(char const *src_path, char const *dst_path);
+    int copy_step();
+    bool step_ls();
+    bool step_rm();
+    bool step_cp();
+    bool step_dump();
+    bool step_cat();
+    bool tar_member(uint8_t const *h);
+    bool step_tar_c();
+    bool step_tar_x();
+    bool step_image();
+    void keep_args(int argc, char **argv);
+    int next_arg();
+    void sum_open();
+    bool step_sum();
+    bool compare_open(char const *filename1, char const *filename2);
+    bool step_cmp();
+    bool diff_line(int k, uint32_t *hash);
+    void diff_seek(int k, uint32_t offset);
+    void diff_print(int k, int line, char const *prefix);
+    void diff_hunk(int n1, int n2);
+    bool step_diff();
+    bool manifest_cached(char const *name, uint64_t size, uint32_t mtime);
+    void manifest_line();
+    bool manifest_end();
+    bool step_manifest();
+    bool step_df();
+    bool step_prealloc();
+    void frag_start(int id);
+    bool frag_open();
+    bool frag_chain();
+    bool frag_free();
+    bool step_frag();
+    void defrag_file();
+    bool defrag_verify();
+    void defrag_swap();
+    bool step_defrag();
+    void fsck_window();
+    bool fsck_own(uint32_t cluster);
+    void fsck_entry();
+    bool fsck_pop();
+    bool fsck_dir();
+    bool fsck_chain();
+    bool fsck_lost();
+    void fsck_report();
+    bool step_fsck();
+
   public:
-    VolumeExplorer(Stream *_t) : term(_t) {
+    VolumeExplorerSession(VolumeExplorerShared *_shared, Stream *_t) : shared(_shared), console(_t), term(_t) {
+        count_output();
+    }
+    void count_output() {
+#ifdef VOLUME_EXPLORER_STATS_ENABLE
+        term_counter.attach(console);
+        console = term = &term_counter;
+#endif
     }
     void init() {
-        if (!sd.begin()) {
-            term->println("sd begin error");
-        }
+#ifdef VOLUME_EXPLORER_STATS_ENABLE
+        vex_stats = &stats;
+#endif
         input_buf_index = 0;
+        last_key = 0;
+        status = VEX_STATUS_OK;
         strcat(path, "/");
-        cmd_ls();
-        prompt();
+        if (shared->volume_count > 0)
+            strcat(path, shared->volumes[0].name);
+        command_start_us = micros();
+        if (!shared->lazy)
+            cmd_ls();
+        if (!busy())
+            command_done();
+    }
+
+    // time given to a running command on each update() call
+    void set_task_budget(uint32_t us) {
+        task_budget_us = us;
+    }
+    bool busy() {
+        return task.state == VEX_TASK_RUNNING;
+    }
+    // nothing running nor waiting to run
+    bool idle() {
+#ifdef VOLUME_EXPLORER_RPC_ENABLE
+        if (rpc.summing)
+            return false;
+#endif
+        return !busy() && !script_f.isOpen() && line_queue_len == 0;
+    }
+
+    // ctrl/q received
+    bool is_stopped() {
+        return stopped;
     }
+    // pathname or something inside it is open, for writing only if !write
+    bool holds(char const *pathname, bool write);
+    bool checking(char const *pathname);
 
     void update();
     void exec_command(char const *buf);
 
-    void cmd_cd(char const *new_path);
-    void cmd_mkdir(char const *pathname);
-    void cmd_rmdir(char const *pathname);
-    void cmd_ls();
-    void cmd_rm(char const *filename);
-    void cmd_mv(char const *filename, char const *new_pathname);
-    void cmd_cp(char const *src_filename, char const *dst_filename);
-    void cmd_dump(char const *filename);
-    void cmd_cat(char const *filename);
-    void cmd_touch(char const *filename);
-    void cmd_recv(char const *filename);
-    void cmd_send(char const *filename);
-    void cmd_dbug();
+    void cmd_batch(int argc, char **argv);
+    void cmd_bench(int argc, char **argv);
+    void cmd_cat(int argc, char **argv);
+    void cmd_cd(int argc, char **argv);
+    void cmd_cmp(int argc, char **argv);
+    void cmd_cp(int argc, char **argv);
+    void cmd_dbug(int argc, char **argv);
+    void cmd_defrag(int argc, char **argv);
+    void cmd_df(int argc, char **argv);
+    void cmd_diff(int argc, char **argv);
+    void cmd_dump(int argc, char **argv);
+    void cmd_frag(int argc, char **argv);
+    void cmd_fsck(int argc, char **argv);
+    void cmd_grep(int argc, char **argv);
+    void cmd_image(int argc, char **argv);
+    void cmd_jobs(int argc, char **argv);
+    void cmd_ls(int argc = 0, char **argv = NULL);
+    void cmd_manifest(int argc, char **argv);
+    void cmd_mem(int argc, char **argv);
+    void cmd_mkdir(int argc, char **argv);
+    void cmd_mv(int argc, char **argv);
+    void cmd_prealloc(int argc, char **argv);
+    void cmd_recv(int argc, char **argv);
+    void cmd_rm(int argc, char **argv);
+    void cmd_rmdir(int argc, char **argv);
+    void cmd_rpc(int argc, char **argv);
+    void cmd_send(int argc, char **argv);
+    void cmd_source(int argc, char **argv);
+    void cmd_stats(int argc, char **argv);
+    void cmd_sum(int argc, char **argv);
+    void cmd_tar(int argc, char **argv);
+    void cmd_touch(int argc, char **argv);
+    void cmd_truncate(int argc, char **argv);
+    void cmd_wc(int argc, char **argv);
+
+    // a built-in of that name exists
+    static bool has_command(char const *name);
+
+  private:
+    // sorted by name for the binary search of find_command(), constant so it
+    // stays in flash, commands compiled out have no entry
+    static constexpr command_t cmds[] = {
+        {.id = CMD_BATCH, .cmd = "batch", .prms = 0, .opts = 1, .run = &VolumeExplorerSession::cmd_batch},
+#ifdef VOLUME_EXPLORER_BENCH_ENABLE
+        {.id = CMD_BENCH, .cmd = "bench", .prms = 0, .opts = 3, .run = &VolumeExplorerSession::cmd_bench},
+#endif
+        {.id = CMD_CAT, .cmd = "cat", .prms = 1, .opts = 0, .run = &VolumeExplorerSession::cmd_cat},
+        {.id = CMD_CD, .cmd = "cd", .prms = 1, .opts = 0, .run = &VolumeExplorerSession::cmd_cd},
+#ifdef VOLUME_EXPLORER_COMPARE_ENABLE
+        {.id = CMD_CMP, .cmd = "cmp", .prms = 2, .opts = 1, .run = &VolumeExplorerSession::cmd_cmp},
+#endif
+        {.id = CMD_CP, .cmd = "cp", .prms = 2, .opts = 0, .run = &VolumeExplorerSession::cmd_cp},
+#if defined(VOLUME_EXPLORER_XMODEM_ENABLE) && defined(VOLUME_EXPLORER_XMODEM_DEBUG)
+        {.id = CMD_DBUG, .cmd = "dbug", .prms = 0, .opts = 0, .run = &VolumeExplorerSession::cmd_dbug}, // Internal use for xmodem debugging
+#endif
+#ifdef VOLUME_EXPLORER_FRAG_ENABLE
+        {.id = CMD_DEFRAG, .cmd = "defrag", .prms = 1, .opts = VOLUME_EXPLORER_MAX_TOKENS - 2, .run = &VolumeExplorerSession::cmd_defrag},
+#endif
+#ifdef VOLUME_EXPLORER_DF_ENABLE
+        {.id = CMD_DF, .cmd = "df", .prms = 0, .opts = 0, .run = &VolumeExplorerSession::cmd_df},
+#endif
+#ifdef VOLUME_EXPLORER_COMPARE_ENABLE
+        {.id = CMD_DIFF, .cmd = "diff", .prms = 2, .opts = 0, .run = &VolumeExplorerSession::cmd_diff},
+#endif
+        {.id = CMD_DUMP, .cmd = "dump", .prms = 1, .opts = 0, .run = &VolumeExplorerSession::cmd_dump},
+#ifdef VOLUME_EXPLORER_FRAG_ENABLE
+        {.id = CMD_FRAG, .cmd = "frag", .prms = 0, .opts = VOLUME_EXPLORER_MAX_TOKENS - 1, .run = &VolumeExplorerSession::cmd_frag},
+#endif
+#ifdef VOLUME_EXPLORER_FSCK_ENABLE
+        {.id = CMD_FSCK, .cmd = "fsck", .prms = 0, .opts = 2, .run = &VolumeExplorerSession::cmd_fsck},
+#endif
+        {.id = CMD_GREP, .cmd = "grep", .prms = 1, .opts = 2, .run = &VolumeExplorerSession::cmd_grep},
+#ifdef VOLUME_EXPLORER_IMAGE_ENABLE
+        {.id = CMD_IMAGE, .cmd = "image", .prms = 1, .opts = 1, .run = &VolumeExplorerSession::cmd_image},
+#endif
+        {.id = CMD_JOBS, .cmd = "jobs", .prms = 0, .opts = 0, .run = &VolumeExplorerSession::cmd_jobs},
+        {.id = CMD_LS, .cmd = "ls", .prms = 0, .opts = 0, .run = &VolumeExplorerSession::cmd_ls},
+#ifdef VOLUME_EXPLORER_MANIFEST_ENABLE
+        {.id = CMD_MANIFEST, .cmd = "manifest", .prms = 0, .opts = 1, .run = &VolumeExplorerSession::cmd_manifest},
+#endif
+        {.id = CMD_MEM, .cmd = "mem", .prms = 0, .opts = 0, .run = &VolumeExplorerSession::cmd_mem},
+        {.id = CMD_MKDIR, .cmd = "mkdir", .prms = 1, .opts = VOLUME_EXPLORER_MAX_TOKENS - 2, .run = &VolumeExplorerSession::cmd_mkdir},
+        {.id = CMD_MV, .cmd = "mv", .prms = 2, .opts = 0, .run = &VolumeExplorerSession::cmd_mv},
+#ifdef VOLUME_EXPLORER_PREALLOC_ENABLE
+        {.id = CMD_PREALLOC, .cmd = "prealloc", .prms = 2, .opts = 0, .run = &VolumeExplorerSession::cmd_prealloc},
+#endif
+#ifdef VOLUME_EXPLORER_XMODEM_ENABLE
+        {.id = CMD_RECV, .cmd = "recv", .prms = 1, .opts = 0, .run = &VolumeExplorerSession::cmd_recv},
+#endif
+        {.id = CMD_RM, .cmd = "rm", .prms = 1, .opts = VOLUME_EXPLORER_MAX_TOKENS - 2, .run = &VolumeExplorerSession::cmd_rm},
+        {.id = CMD_RMDIR, .cmd = "rmdir", .prms = 1, .opts = VOLUME_EXPLORER_MAX_TOKENS - 2, .run = &VolumeExplorerSession::cmd_rmdir},
+#ifdef VOLUME_EXPLORER_RPC_ENABLE
+        {.id = CMD_RPC, .cmd = "rpc", .prms = 0, .opts = 0, .run = &VolumeExplorerSession::cmd_rpc},
+#endif
+#ifdef VOLUME_EXPLORER_XMODEM_ENABLE
+        {.id = CMD_SEND, .cmd = "send", .prms = 1, .opts = 0, .run = &VolumeExplorerSession::cmd_send},
+#endif
+        {.id = CMD_SOURCE, .cmd = "source", .prms = 1, .opts = 0, .run = &VolumeExplorerSession::cmd_source},
+#ifdef VOLUME_EXPLORER_STATS_ENABLE
+        {.id = CMD_STATS, .cmd = "stats", .prms = 0, .opts = 0, .run = &VolumeExplorerSession::cmd_stats},
+#endif
+#ifdef VOLUME_EXPLORER_SUM_ENABLE
+        {.id = CMD_SUM, .cmd = "sum", .prms = 1, .opts = VOLUME_EXPLORER_MAX_TOKENS - 2, .run = &VolumeExplorerSession::cmd_sum},
+#endif
+#ifdef VOLUME_EXPLORER_TAR_ENABLE
+        {.id = CMD_TAR, .cmd = "tar", .prms = 1, .opts = 2, .run = &VolumeExplorerSession::cmd_tar},
+#endif
+        {.id = CMD_TOUCH, .cmd = "touch", .prms = 1, .opts = VOLUME_EXPLORER_MAX_TOKENS - 2, .run = &VolumeExplorerSession::cmd_touch},
+#ifdef VOLUME_EXPLORER_PREALLOC_ENABLE
+        {.id = CMD_TRUNCATE, .cmd = "truncate", .prms = 1, .opts = 1, .run = &VolumeExplorerSession::cmd_truncate},
+#endif
+        {.id = CMD_WC, .cmd = "wc", .prms = 1, .opts = 0, .run = &VolumeExplorerSession::cmd_wc},
+    };
+};
+
+// Volumes and the sessions served by update(), the first session runs on
+// the Stream given at construction, add_session() adds more
+class VolumeExplorer {
+    VolumeExplorerShared shared;
+    Stream *console; // first session's, gets the mount errors
+    bool started = false;
+
+  public:
+    VolumeExplorer(Stream *_t) : console(_t) {
+        VolumeExplorerMount sd0 = {.name = "sd0", .backend = VEX_BACKEND_SDIO, .cs_pin = 0};
+        add_volume(sd0);
+        add_session(_t);
+    }
+    VolumeExplorer(Stream *_t, VolumeExplorerMount const *mounts, uint8_t count) : console(_t) {
+        for (uint8_t i = 0; i < count; i++)
+            add_volume(mounts[i]);
+        add_session(_t);
+    }
+    bool add_volume(VolumeExplorerMount const &mount) {
+        if (shared.volume_count == VOLUME_EXPLORER_MAX_VOLUMES)
+            return false;
+        VolumeExplorerVolume &vol = shared.volumes[shared.volume_count++];
+        strlcpy(vol.name, mount.name, VOLUME_EXPLORER_VOLUME_NAME_LEN);
+        vol.backend = mount.backend;
+        vol.cs_pin = mount.cs_pin;
+        return true;
+    }
+    bool add_session(Stream *_t) {
+        if (shared.session_count == VOLUME_EXPLORER_MAX_SESSIONS)
+            return false;
+        VolumeExplorerSession *s = new VolumeExplorerSession(&shared, _t);
+        shared.sessions[shared.session_count++] = s;
+        if (started)
+            s->init();
+        return true;
+    }
+    // false when the table is full or the name is taken
+    bool add_command(char const *name, uint8_t prms, uint8_t opts, VolumeExplorerHandler run, void *ctx = NULL);
+    VolumeExplorerSession *session(uint8_t i) {
+        return i < shared.session_count ? shared.sessions[i] : NULL;
+    }
+    // lazy leaves the cards alone until a command needs them and skips the
+    // first listing, so that init() costs next to nothing at boot
+    void init(bool lazy = false) {
+        vex_stack_paint();
+        shared.lazy = lazy;
+        for (uint8_t i = 0; i < shared.volume_count && !lazy; i++) {
+            if (!shared.mount(&shared.volumes[i]))
+                console->printf("%s begin error\n", shared.volumes[i].name);
+        }
+        started = true;
+        for (uint8_t i = 0; i < shared.session_count; i++)
+            shared.sessions[i]->init();
+    }
+
+    void set_task_budget(uint32_t us) {
+        shared.scan_budget_us = us;
+        for (uint8_t i = 0; i < shared.session_count; i++)
+            shared.sessions[i]->set_task_budget(us);
+    }
+    bool busy() {
+        for (uint8_t i = 0; i < shared.session_count; i++)
+            if (shared.sessions[i]->busy())
+                return true;
+        return false;
+    }
+    bool idle() {
+        for (uint8_t i = 0; i < shared.session_count; i++)
+            if (!shared.sessions[i]->is_stopped() && !shared.sessions[i]->idle())
+                return false;
+        return true;
+    }
+    bool is_stopped() {
+        for (uint8_t i = 0; i < shared.session_count; i++)
+            if (!shared.sessions[i]->is_stopped())
+                return false;
+        return true;
+    }
+
+    // each session gets its turn, so one budget per session, the volume scan
+    // gets one more once they are all idle
+    void update() {
+        for (uint8_t i = 0; i < shared.session_count; i++)
+            shared.sessions[i]->update();
+        if (idle())
+            shared.scan();
+    }
+    void exec_command(char const *buf) {
+        shared.sessions[0]->exec_command(buf);
+    }
 };
 
 #endif
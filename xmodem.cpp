@@ -52,7 +52,7 @@ void VexXModem::send_packet(uint8_t *buf, uint16_t size) {
 }
 
 // https://fieldeffect.info/wp/frontpage/xmodem/
-void VexXModem::receive(SdFile &file) {
+void VexXModem::receive(FsFile &file) {
     uint8_t buf[XMODEM_BLOCK_SIZE + 1]; // for checksum
     uint16_t buf_index;
     uint8_t pck_number;
@@ -83,6 +83,8 @@ void VexXModem::receive(SdFile &file) {
                     if (write_packet && buf_index > 0) {
                         file.write(buf, XMODEM_BLOCK_SIZE);
                         file.sync();
+                        VEX_STAT(bytes_written, XMODEM_BLOCK_SIZE);
+                        VEX_STAT(syncs, 1);
                         write_packet = false;
                     }
                     pck_number = in();
@@ -94,6 +96,8 @@ void VexXModem::receive(SdFile &file) {
                         out(XM_CAN);
                         file.write(buf, buf_index);
                         file.sync();
+                        VEX_STAT(bytes_written, buf_index);
+                        VEX_STAT(syncs, 1);
                         cont = false;
                     }
 
@@ -107,6 +111,8 @@ void VexXModem::receive(SdFile &file) {
                             i--;
                         file.write(buf, i + 1);
                         file.sync();
+                        VEX_STAT(bytes_written, i + 1);
+                        VEX_STAT(syncs, 1);
                         cont = false;
                     }
                     out(XM_ACK);
@@ -130,13 +136,14 @@ void VexXModem::receive(SdFile &file) {
     };
 }
 
-void VexXModem::send(SdFile &file) {
+void VexXModem::send(FsFile &file) {
     uint8_t buf[XMODEM_BLOCK_SIZE];
     int n;
     bool must_send = false;
 
     packet_num = 0;
     while ((n = file.read(buf, XMODEM_BLOCK_SIZE)) > 0) {
+        VEX_STAT(bytes_read, n);
         bool cont = true;
         packet_num++;
         while (cont) {
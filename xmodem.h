@@ -25,6 +25,7 @@
 
 #include <Arduino.h>
 #include <SdFat.h>
+#include "stats.h"
 
 #define XMODEM_BLOCK_SIZE 128
 
@@ -38,7 +39,7 @@
 class VexXModem {
     Stream *s;
     uint8_t packet_num;
-    SdFile log;
+    FsFile log;
 
     enum State { WAIT_CMD, WAIT_DATA };
     State state;
@@ -92,8 +93,8 @@ class VexXModem {
         if (log_enabled)
             log.close();
     }
-    void receive(SdFile &file);
-    void send(SdFile &file);
+    void receive(FsFile &file);
+    void send(FsFile &file);
     bool packet_valid(uint8_t *buf);
     void send_packet(uint8_t *buf, uint16_t size);
     void enable_fast_write(bool v) {